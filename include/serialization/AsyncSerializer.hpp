@@ -0,0 +1,605 @@
+/**
+ * @file AsyncSerializer.hpp
+ *
+ * Asynchronous serialization stage: producers hand objects to a pool
+ * of worker threads which serialize them into pooled buffers, so that
+ * packing can overlap with whatever the producer does next (eg I/O)
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_ASYNCSERIALIZER_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_ASYNCSERIALIZER_HPP_
+
+#include "serialization/MPMCQueue.hpp"
+#include "serialization/Serialization.hpp"
+
+#include "ers/ers.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+
+// clang-format off
+// Disable coverage collection LCOV_EXCL_START
+ERS_DECLARE_ISSUE(serialization,                        // namespace
+                  AsyncCallbackFailed,                  // issue name
+                  "AsyncSerializer result callback threw an exception",) // message
+
+// clang-format on
+// Re-enable coverage collection LCOV_EXCL_STOP
+
+namespace serialization {
+
+/**
+ * @brief A free list of byte buffers, so that steady-state
+ * serialization doesn't allocate a new vector per message
+ */
+class BufferPool
+{
+public:
+  /**
+   * @param max_buffers Maximum number of idle buffers kept in the pool
+   * @param max_retained_bytes Buffers with a larger capacity than this
+   * are freed instead of being returned to the pool, so that one huge
+   * message doesn't pin its memory forever
+   */
+  explicit BufferPool(std::size_t max_buffers = 64, std::size_t max_retained_bytes = 16 * 1024 * 1024)
+    : m_free(max_buffers)
+    , m_max_retained_bytes(max_retained_bytes)
+  {}
+
+  std::vector<uint8_t> acquire() // NOLINT(build/unsigned)
+  {
+    std::vector<uint8_t> buf; // NOLINT(build/unsigned)
+    m_free.try_pop(buf);
+    return buf;
+  }
+
+  void release(std::vector<uint8_t>&& buf) // NOLINT(build/unsigned)
+  {
+    if (buf.capacity() == 0 || buf.capacity() > m_max_retained_bytes)
+      return;
+    buf.clear();
+    m_free.try_push(std::move(buf));
+  }
+
+private:
+  MPMCQueue<std::vector<uint8_t>> m_free; // NOLINT(build/unsigned)
+  std::size_t m_max_retained_bytes;
+};
+
+/**
+ * @brief A serialized message whose storage goes back to its
+ * BufferPool when it is destroyed
+ */
+class PooledBuffer
+{
+public:
+  PooledBuffer() = default;
+  PooledBuffer(std::vector<uint8_t>&& buf, std::weak_ptr<BufferPool> pool) // NOLINT(build/unsigned)
+    : m_buf(std::move(buf))
+    , m_pool(std::move(pool))
+  {}
+
+  PooledBuffer(PooledBuffer&&) = default;
+  PooledBuffer& operator=(PooledBuffer&& other)
+  {
+    if (this != &other) {
+      give_back();
+      m_buf = std::move(other.m_buf);
+      m_pool = std::move(other.m_pool);
+    }
+    return *this;
+  }
+  PooledBuffer(const PooledBuffer&) = delete;
+  PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+  ~PooledBuffer() { give_back(); }
+
+  /**
+   * @brief The serialized message, suitable for passing to deserialize()
+   */
+  const std::vector<uint8_t>& bytes() const { return m_buf; } // NOLINT(build/unsigned)
+  const uint8_t* data() const { return m_buf.data(); }        // NOLINT(build/unsigned)
+  std::size_t size() const { return m_buf.size(); }
+
+  /**
+   * @brief Take ownership of the underlying vector. It will not be
+   * returned to the pool
+   */
+  std::vector<uint8_t> release() // NOLINT(build/unsigned)
+  {
+    m_pool.reset();
+    return std::move(m_buf);
+  }
+
+private:
+  void give_back()
+  {
+    if (auto pool = m_pool.lock())
+      pool->release(std::move(m_buf));
+    m_pool.reset();
+  }
+
+  std::vector<uint8_t> m_buf; // NOLINT(build/unsigned)
+  std::weak_ptr<BufferPool> m_pool;
+};
+
+/**
+ * @brief Snapshot of the counters kept by an AsyncSerializer
+ */
+struct AsyncSerializerMetrics
+{
+  std::size_t queue_depth = 0;     ///< Jobs waiting for a worker
+  std::size_t max_queue_depth = 0; ///< High-water mark of queue_depth
+  std::size_t queue_capacity = 0;
+  uint64_t submitted = 0;          // NOLINT(build/unsigned)
+  uint64_t completed = 0;          // NOLINT(build/unsigned)
+  uint64_t failed = 0;             // NOLINT(build/unsigned)
+  uint64_t backpressure_waits = 0; ///< Times submit() blocked on a full queue // NOLINT(build/unsigned)
+  uint64_t rejected = 0;           ///< Times try_submit() found the queue full // NOLINT(build/unsigned)
+  uint64_t callback_failures = 0;  ///< Callbacks that threw an exception // NOLINT(build/unsigned)
+};
+
+/**
+ * @brief Serializes objects of type @p T on a pool of worker threads
+ *
+ * Objects are submitted through a Producer handle, obtained from
+ * make_producer(). Each Producer should be used from one thread at a
+ * time, and results for a given Producer are delivered (futures made
+ * ready, or callbacks run) in the order its objects were submitted,
+ * regardless of which worker serialized them. Callbacks run on a
+ * worker thread with no lock held, so a callback may submit to its own
+ * Producer, and a slow one holds up that worker but not submission.
+ * A blocking submit() from a callback never waits for the queue: the
+ * workers are the only threads that free slots, so if it is full, the
+ * calling worker serializes the object itself.
+ * An exception thrown by a callback is reported with ers::error() and
+ * counted in AsyncSerializerMetrics::callback_failures.
+ *
+ * Submission goes through a bounded lock-free queue. When it is full,
+ * submit() blocks until a worker frees a slot, and try_submit()
+ * returns without submitting. Destroying the AsyncSerializer
+ * serializes everything already submitted before joining the
+ * workers. Producers must not outlive their AsyncSerializer.
+ *
+ * Example:
+ *
+ *      AsyncSerializer<MyType> async(kMsgPack, 4);
+ *      auto producer = async.make_producer();
+ *      std::future<PooledBuffer> f = producer.submit(std::move(obj));
+ *      ...
+ *      send(f.get().bytes());
+ */
+template<class T>
+class AsyncSerializer
+{
+public:
+  using Callback = std::function<void(PooledBuffer&&, std::exception_ptr)>;
+
+private:
+  struct ProducerState
+  {
+    std::mutex mutex;
+    uint64_t next_seq = 0; // NOLINT(build/unsigned)
+    uint64_t next_to_deliver = 0; // NOLINT(build/unsigned)
+    std::map<uint64_t, std::pair<PooledBuffer, std::exception_ptr>> ready; // NOLINT(build/unsigned)
+    std::map<uint64_t, std::pair<std::promise<PooledBuffer>, Callback>> sinks; // NOLINT(build/unsigned)
+    // Set while a worker is handing results to their sinks. Other
+    // workers then just leave their results in `ready` for it, so
+    // results are delivered in order without holding the mutex
+    bool delivering = false;
+  };
+
+  struct Delivery
+  {
+    std::promise<PooledBuffer> promise;
+    Callback cb;
+    PooledBuffer result;
+    std::exception_ptr err;
+  };
+
+  struct Job
+  {
+    std::optional<T> obj;
+    std::shared_ptr<ProducerState> producer;
+    uint64_t seq = 0; // NOLINT(build/unsigned)
+  };
+
+public:
+  /**
+   * @brief Handle through which one thread submits objects
+   */
+  class Producer
+  {
+  public:
+    Producer(Producer&&) = default;
+    Producer& operator=(Producer&&) = default;
+    Producer(const Producer&) = delete;
+    Producer& operator=(const Producer&) = delete;
+
+    /**
+     * @brief Submit @p obj, blocking while the queue is full (or, from
+     * a callback, serializing it on the spot)
+     */
+    std::future<PooledBuffer> submit(T&& obj)
+    {
+      std::promise<PooledBuffer> promise;
+      auto fut = promise.get_future();
+      m_owner->submit_impl(m_state, std::move(obj), std::move(promise), Callback(), true);
+      return fut;
+    }
+
+    /**
+     * @brief Submit @p obj, blocking while the queue is full. @p cb is
+     * called with the result once it and all earlier results from
+     * this Producer are ready
+     */
+    void submit(T&& obj, Callback cb)
+    {
+      m_owner->submit_impl(m_state, std::move(obj), std::promise<PooledBuffer>(), std::move(cb), true);
+    }
+
+    /**
+     * @brief Submit @p obj if there is room in the queue. Returns
+     * false, leaving @p obj untouched, if there isn't
+     */
+    bool try_submit(T&& obj, Callback cb)
+    {
+      return m_owner->submit_impl(m_state, std::move(obj), std::promise<PooledBuffer>(), std::move(cb), false);
+    }
+
+  private:
+    friend class AsyncSerializer;
+    explicit Producer(AsyncSerializer* owner)
+      : m_owner(owner)
+      , m_state(std::make_shared<ProducerState>())
+    {}
+
+    AsyncSerializer* m_owner;
+    std::shared_ptr<ProducerState> m_state;
+  };
+
+  /**
+   * @param stype Serialization method used for all objects
+   * @param n_workers Number of worker threads
+   * @param queue_capacity Maximum number of objects waiting to be
+   * serialized (rounded up to a power of two)
+   */
+  explicit AsyncSerializer(SerializationType stype, std::size_t n_workers = 1, std::size_t queue_capacity = 1024)
+    : m_stype(stype)
+    , m_queue(queue_capacity)
+    , m_pool(std::make_shared<BufferPool>(std::max<std::size_t>(queue_capacity, 64)))
+  {
+    serialization_type_byte(stype); // Throws if stype is invalid
+    for (std::size_t i = 0; i < std::max<std::size_t>(n_workers, 1); ++i) {
+      m_workers.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  AsyncSerializer(const AsyncSerializer&) = delete;
+  AsyncSerializer& operator=(const AsyncSerializer&) = delete;
+
+  ~AsyncSerializer()
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_running = false;
+    }
+    m_work_cv.notify_all();
+    for (auto& t : m_workers)
+      t.join();
+  }
+
+  Producer make_producer() { return Producer(this); }
+
+  AsyncSerializerMetrics get_metrics() const
+  {
+    AsyncSerializerMetrics m;
+    m.queue_depth = m_queue.size_approx();
+    m.max_queue_depth = m_max_queue_depth.load(std::memory_order_relaxed);
+    m.queue_capacity = m_queue.capacity();
+    m.submitted = m_submitted.load(std::memory_order_relaxed);
+    m.completed = m_completed.load(std::memory_order_relaxed);
+    m.failed = m_failed.load(std::memory_order_relaxed);
+    m.backpressure_waits = m_backpressure_waits.load(std::memory_order_relaxed);
+    m.rejected = m_rejected.load(std::memory_order_relaxed);
+    m.callback_failures = m_callback_failures.load(std::memory_order_relaxed);
+    return m;
+  }
+
+private:
+  // The sleeping scheme for both workers (waiting for work) and
+  // producers (waiting for space) is the same: the waiting side
+  // increments a "sleepers" counter and then re-checks the queue under
+  // m_mutex before waiting; the other side only takes m_mutex to
+  // notify if it sees sleepers. The seq_cst fences on both sides make
+  // sure that at least one of them sees the other's write, so no
+  // wakeup is lost
+  static constexpr int s_spin_count = 64;
+
+  bool submit_impl(const std::shared_ptr<ProducerState>& state,
+                   T&& obj,
+                   std::promise<PooledBuffer>&& promise,
+                   Callback&& cb,
+                   bool block)
+  {
+    // Register the sink before the job becomes visible to the
+    // workers, so that a fast worker always finds it. The sequence
+    // number is taken under the mutex too, since a callback may submit
+    // to the same producer from a worker thread
+    uint64_t seq; // NOLINT(build/unsigned)
+    {
+      std::lock_guard<std::mutex> lk(state->mutex);
+      seq = state->next_seq++;
+      state->sinks.emplace(seq, std::make_pair(std::move(promise), std::move(cb)));
+    }
+
+    Job job;
+    job.producer = state;
+    job.seq = seq;
+    job.obj.emplace(std::move(obj));
+
+    if (!m_queue.try_push(std::move(job))) {
+      if (!block) {
+        // Hand the object back untouched
+        obj = std::move(*job.obj);
+        bool give_back_seq;
+        {
+          std::lock_guard<std::mutex> lk(state->mutex);
+          state->sinks.erase(seq);
+          give_back_seq = state->next_seq == seq + 1;
+          if (give_back_seq)
+            --state->next_seq;
+          else
+            state->ready.emplace(seq, std::make_pair(PooledBuffer(), nullptr));
+        }
+        // If a callback has submitted in the meantime, the sequence
+        // number can't be reused, so an empty result with no sink has
+        // taken its place. Later results may be waiting for it, and are
+        // handed over by a worker, since their callbacks mustn't run here
+        if (!give_back_seq)
+          schedule_delivery(state);
+        m_rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      m_backpressure_waits.fetch_add(1, std::memory_order_relaxed);
+      if (current_worker_owner() == this) {
+        // Waiting here could deadlock, if every worker is blocked in
+        // a callback. Results are still delivered in order, since
+        // deliver() doesn't depend on who serialized them
+        m_submitted.fetch_add(1, std::memory_order_relaxed);
+        run_job(job);
+        return true;
+      }
+      while (!m_queue.try_push(std::move(job))) {
+        m_waiting_producers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+          std::unique_lock<std::mutex> lk(m_mutex);
+          if (m_queue.size_approx() >= m_queue.capacity())
+            m_space_cv.wait(lk);
+        }
+        m_waiting_producers.fetch_sub(1, std::memory_order_relaxed);
+      }
+    }
+
+    m_submitted.fetch_add(1, std::memory_order_relaxed);
+    std::size_t depth = m_queue.size_approx();
+    std::size_t prev_max = m_max_queue_depth.load(std::memory_order_relaxed);
+    while (depth > prev_max && !m_max_queue_depth.compare_exchange_weak(prev_max, depth, std::memory_order_relaxed)) {
+    }
+
+    wake_worker();
+    return true;
+  }
+
+  void wake_worker()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping_workers.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_work_cv.notify_one();
+    }
+  }
+
+  // Have a worker hand over the results that are ready for @p state
+  void schedule_delivery(const std::shared_ptr<ProducerState>& state)
+  {
+    {
+      std::lock_guard<std::mutex> lk(m_mutex);
+      m_undelivered.push_back(state);
+      m_have_undelivered.store(true, std::memory_order_relaxed);
+    }
+    wake_worker();
+  }
+
+  void run_scheduled_deliveries()
+  {
+    while (m_have_undelivered.load(std::memory_order_relaxed)) {
+      std::vector<std::shared_ptr<ProducerState>> states;
+      {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        states.swap(m_undelivered);
+        m_have_undelivered.store(false, std::memory_order_relaxed);
+      }
+      for (auto& state : states) {
+        std::unique_lock<std::mutex> lk(state->mutex);
+        deliver_ready(*state, lk);
+      }
+    }
+  }
+
+  bool next_job(Job& job)
+  {
+    for (;;) {
+      for (int i = 0; i < s_spin_count; ++i) {
+        run_scheduled_deliveries();
+        if (m_queue.try_pop(job))
+          return true;
+        std::this_thread::yield();
+      }
+      m_sleeping_workers.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool running;
+      {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_queue.empty_approx() && m_running && !m_have_undelivered.load(std::memory_order_relaxed))
+          m_work_cv.wait(lk);
+        running = m_running;
+      }
+      m_sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+      if (m_queue.try_pop(job))
+        return true;
+      if (!running) {
+        run_scheduled_deliveries();
+        return false;
+      }
+    }
+  }
+
+  // The AsyncSerializer whose worker is the calling thread, if any
+  static const AsyncSerializer*& current_worker_owner()
+  {
+    thread_local const AsyncSerializer* owner = nullptr;
+    return owner;
+  }
+
+  void worker_loop()
+  {
+    current_worker_owner() = this;
+    Job job;
+    while (next_job(job)) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (m_waiting_producers.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_space_cv.notify_all();
+      }
+      run_job(job);
+      run_scheduled_deliveries();
+    }
+  }
+
+  void run_job(Job& job)
+  {
+    std::vector<uint8_t> buf = m_pool->acquire(); // NOLINT(build/unsigned)
+    std::exception_ptr err;
+    try {
+      serialize_into(*job.obj, m_stype, buf);
+    } catch (...) {
+      err = std::current_exception();
+    }
+    job.obj.reset();
+    deliver(*job.producer, job.seq, PooledBuffer(std::move(buf), m_pool), err);
+    job.producer.reset();
+  }
+
+  // Hand the result for @p seq to its sink, but only once all earlier
+  // results from the same producer have been handed over. Sinks are
+  // invoked after releasing the producer's mutex
+  void deliver(ProducerState& state, uint64_t seq, PooledBuffer&& buf, std::exception_ptr err) // NOLINT
+  {
+    std::unique_lock<std::mutex> lk(state.mutex);
+    state.ready.emplace(seq, std::make_pair(std::move(buf), err));
+    deliver_ready(state, lk);
+  }
+
+  // Hand over the results in `ready` that are next in order. @p lk
+  // holds the producer's mutex
+  void deliver_ready(ProducerState& state, std::unique_lock<std::mutex>& lk)
+  {
+    if (state.delivering)
+      return;
+    state.delivering = true;
+
+    std::vector<Delivery> batch;
+    for (;;) {
+      for (auto it = state.ready.find(state.next_to_deliver); it != state.ready.end();
+           it = state.ready.find(state.next_to_deliver)) {
+        auto sink_it = state.sinks.find(it->first);
+        if (sink_it != state.sinks.end()) { // No sink for a rejected try_submit()
+          batch.push_back(Delivery{ std::move(sink_it->second.first),
+                                    std::move(sink_it->second.second),
+                                    std::move(it->second.first),
+                                    it->second.second });
+          state.sinks.erase(sink_it);
+        }
+        state.ready.erase(it);
+        ++state.next_to_deliver;
+      }
+      if (batch.empty()) {
+        state.delivering = false;
+        return;
+      }
+
+      lk.unlock();
+      for (auto& d : batch) {
+        if (d.err)
+          m_failed.fetch_add(1, std::memory_order_relaxed);
+        if (d.cb) {
+          try {
+            d.cb(std::move(d.result), d.err);
+          } catch (std::exception& e) {
+            m_callback_failures.fetch_add(1, std::memory_order_relaxed);
+            ers::error(AsyncCallbackFailed(ERS_HERE, e));
+          } catch (...) {
+            m_callback_failures.fetch_add(1, std::memory_order_relaxed);
+            ers::error(AsyncCallbackFailed(ERS_HERE));
+          }
+        } else if (d.err) {
+          d.promise.set_exception(d.err);
+        } else {
+          d.promise.set_value(std::move(d.result));
+        }
+        m_completed.fetch_add(1, std::memory_order_relaxed);
+      }
+      batch.clear();
+      lk.lock();
+    }
+  }
+
+  SerializationType m_stype;
+  MPMCQueue<Job> m_queue;
+  std::shared_ptr<BufferPool> m_pool;
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_work_cv;
+  std::condition_variable m_space_cv;
+  bool m_running = true;
+  std::atomic<int> m_sleeping_workers{ 0 };
+  std::atomic<int> m_waiting_producers{ 0 };
+  // Producers with results that a rejected try_submit() left for a
+  // worker to hand over. Guarded by m_mutex
+  std::vector<std::shared_ptr<ProducerState>> m_undelivered;
+  std::atomic<bool> m_have_undelivered{ false };
+
+  std::atomic<std::size_t> m_max_queue_depth{ 0 };
+  std::atomic<uint64_t> m_submitted{ 0 };          // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_completed{ 0 };          // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_failed{ 0 };             // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_backpressure_waits{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_rejected{ 0 };           // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_callback_failures{ 0 };  // NOLINT(build/unsigned)
+};
+
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_ASYNCSERIALIZER_HPP_
@@ -0,0 +1,168 @@
+/**
+ * @file Checksum.hpp
+ *
+ * CRC32C (Castagnoli) checksum, used to detect corrupted messages. On
+ * x86-64 CPUs with SSE4.2, and ARMv8 CPUs with the CRC extension, the
+ * hardware CRC32C instructions are used; otherwise a slicing-by-8
+ * table implementation
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_CHECKSUM_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_CHECKSUM_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SERIALIZATION_CRC32C_X86 1
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define SERIALIZATION_CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace dunedaq {
+namespace serialization {
+namespace detail {
+
+// Reflected CRC32C polynomial
+constexpr uint32_t crc32c_poly = 0x82f63b78; // NOLINT(build/unsigned)
+
+using Crc32cTables = std::array<std::array<uint32_t, 256>, 8>; // NOLINT(build/unsigned)
+
+constexpr Crc32cTables
+make_crc32c_tables()
+{
+  Crc32cTables t{};
+  for (uint32_t i = 0; i < 256; ++i) { // NOLINT(build/unsigned)
+    uint32_t crc = i;                  // NOLINT(build/unsigned)
+    for (int j = 0; j < 8; ++j)
+      crc = (crc >> 1) ^ ((crc & 1) ? crc32c_poly : 0);
+    t[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; ++i) { // NOLINT(build/unsigned)
+    for (int k = 1; k < 8; ++k)
+      t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+  }
+  return t;
+}
+
+inline constexpr Crc32cTables crc32c_tables = make_crc32c_tables();
+
+/**
+ * @brief Portable CRC32C: slicing-by-8. @p crc is the raw
+ * (non-inverted) running value
+ */
+inline uint32_t                                                // NOLINT(build/unsigned)
+crc32c_sw(uint32_t crc, const uint8_t* p, std::size_t size) // NOLINT(build/unsigned)
+{
+  const auto& t = crc32c_tables;
+  while (size >= 8) {
+    uint64_t word; // NOLINT(build/unsigned)
+    std::memcpy(&word, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    word ^= crc;
+    crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+          t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    p += 8;
+    size -= 8;
+  }
+  while (size--)
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  return crc;
+}
+
+#if defined(SERIALIZATION_CRC32C_X86)
+
+__attribute__((target("sse4.2"))) inline uint32_t // NOLINT(build/unsigned)
+crc32c_hw(uint32_t crc, const uint8_t* p, std::size_t size) // NOLINT(build/unsigned)
+{
+  uint64_t crc64 = crc; // NOLINT(build/unsigned)
+  while (size >= 8) {
+    uint64_t word; // NOLINT(build/unsigned)
+    std::memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    size -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64); // NOLINT(build/unsigned)
+  while (size--)
+    crc = _mm_crc32_u8(crc, *p++);
+  return crc;
+}
+
+inline bool
+crc32c_hw_available()
+{
+  static const bool available = __builtin_cpu_supports("sse4.2");
+  return available;
+}
+
+#elif defined(SERIALIZATION_CRC32C_ARM)
+
+inline uint32_t                                                // NOLINT(build/unsigned)
+crc32c_hw(uint32_t crc, const uint8_t* p, std::size_t size) // NOLINT(build/unsigned)
+{
+  while (size >= 8) {
+    uint64_t word; // NOLINT(build/unsigned)
+    std::memcpy(&word, p, 8);
+    crc = __crc32cd(crc, word);
+    p += 8;
+    size -= 8;
+  }
+  while (size--)
+    crc = __crc32cb(crc, *p++);
+  return crc;
+}
+
+inline bool
+crc32c_hw_available()
+{
+  return true;
+}
+
+#else
+
+inline uint32_t                                                // NOLINT(build/unsigned)
+crc32c_hw(uint32_t crc, const uint8_t* p, std::size_t size) // NOLINT(build/unsigned)
+{
+  return crc32c_sw(crc, p, size);
+}
+
+inline bool
+crc32c_hw_available()
+{
+  return false;
+}
+
+#endif
+
+} // namespace detail
+
+/**
+ * @brief Compute the CRC32C of the @p size bytes at @p data
+ *
+ * To checksum data in pieces, pass the result for the previous piece
+ * as @p crc
+ */
+inline uint32_t // NOLINT(build/unsigned)
+crc32c(const void* data, std::size_t size, uint32_t crc = 0) // NOLINT(build/unsigned)
+{
+  const uint8_t* p = static_cast<const uint8_t*>(data); // NOLINT(build/unsigned)
+  crc = ~crc;
+  crc = detail::crc32c_hw_available() ? detail::crc32c_hw(crc, p, size) : detail::crc32c_sw(crc, p, size);
+  return ~crc;
+}
+
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_CHECKSUM_HPP_
@@ -0,0 +1,289 @@
+/**
+ * @file ChunkedBlob.hpp
+ *
+ * A large binary payload stored as a list of bounded segments, so that
+ * it can be serialized beyond the 4 GiB limit of a single MsgPack BIN
+ * field, and without needing one giant contiguous allocation on
+ * either side
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_CHUNKEDBLOB_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_CHUNKEDBLOB_HPP_
+
+#include "serialization/Serialization.hpp"
+
+#include "msgpack.hpp"
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace serialization {
+
+/**
+ * @brief A binary payload made of a list of segments
+ *
+ * Segments either view memory owned by someone else (see view()),
+ * which is how a large buffer is serialized without copying it into
+ * the object first, or own their memory. Copies of a ChunkedBlob share
+ * owned segments.
+ *
+ * By default, deserializing copies each segment into its own
+ * allocation. A ChunkedBlob constructed with kBorrowSegments instead
+ * views the segments in the MsgPack message being deserialized, which
+ * must then outlive it; that avoids holding the payload twice while
+ * the message is still around. (A decompressed message is owned by
+ * the borrowing blob itself. JSON messages are always copied.)
+ *
+ * The mode belongs to the object being filled: a copy or move
+ * constructed blob takes the mode of its source, but assigning to a
+ * blob keeps its own mode. So kBorrowSegments only works through
+ * deserialize_into(). deserialize<T>() builds its result
+ * with as<T>(), which default-constructs the blob in copy mode (unless
+ * T's own default constructor sets the mode). Segments decoded by
+ * DeltaDecoder or StringInternDecoder are always copied too, since
+ * those decoders unpack from buffers that they reuse or that the
+ * caller may free.
+ *
+ * In MsgPack, a ChunkedBlob is an array of BIN fields, one per
+ * segment. Each segment is at most max_segment_size bytes; longer
+ * ones are split when appended. In JSON, it is an array of arrays of
+ * byte values.
+ */
+class ChunkedBlob
+{
+public:
+  /**
+   * @brief Largest segment that fits in a MsgPack BIN field
+   */
+  static constexpr std::size_t max_segment_size = 0xffffffff;
+  static constexpr std::size_t default_segment_size = 64 * 1024 * 1024;
+
+  struct Segment
+  {
+    const uint8_t* data; // NOLINT(build/unsigned)
+    std::size_t size;
+  };
+
+  /**
+   * @brief How deserializing fills in the segments
+   */
+  enum DecodeMode
+  {
+    kCopySegments,  ///< Each segment is copied into its own allocation
+    kBorrowSegments ///< Segments view the message being deserialized
+  };
+
+  ChunkedBlob() = default;
+  explicit ChunkedBlob(DecodeMode mode)
+    : m_decode_mode(mode)
+  {}
+
+  ChunkedBlob(const ChunkedBlob&) = default;
+  ChunkedBlob(ChunkedBlob&& other) noexcept
+    : m_segments(std::move(other.m_segments))
+    , m_owners(std::move(other.m_owners))
+    , m_size(std::exchange(other.m_size, 0))
+    , m_decode_mode(other.m_decode_mode)
+  {}
+
+  // Assignment replaces the segments, but keeps the decode mode, which
+  // is a setting of this object rather than part of its value
+  ChunkedBlob& operator=(const ChunkedBlob& other)
+  {
+    m_segments = other.m_segments;
+    m_owners = other.m_owners;
+    m_size = other.m_size;
+    return *this;
+  }
+  ChunkedBlob& operator=(ChunkedBlob&& other) noexcept
+  {
+    m_segments = std::move(other.m_segments);
+    m_owners = std::move(other.m_owners);
+    m_size = std::exchange(other.m_size, 0);
+    return *this;
+  }
+
+  /**
+   * @brief Make a ChunkedBlob viewing the @p size bytes at @p data,
+   * split into segments of at most @p segment_size bytes. The memory
+   * is not copied, and must outlive the ChunkedBlob
+   */
+  static ChunkedBlob view(const void* data, std::size_t size, std::size_t segment_size = default_segment_size)
+  {
+    segment_size = std::clamp<std::size_t>(segment_size, 1, max_segment_size);
+    ChunkedBlob ret;
+    const uint8_t* p = static_cast<const uint8_t*>(data); // NOLINT(build/unsigned)
+    for (std::size_t off = 0; off < size; off += segment_size) {
+      ret.append_view(p + off, std::min(segment_size, size - off));
+    }
+    return ret;
+  }
+
+  /**
+   * @brief Append a segment viewing memory owned elsewhere
+   */
+  void append_view(const void* data, std::size_t size) { append_shared(data, size, nullptr); }
+
+  /**
+   * @brief Append a segment viewing memory that is kept alive by @p owner
+   */
+  void append_shared(const void* data, std::size_t size, std::shared_ptr<const void> owner)
+  {
+    // Split segments that are too big for a BIN field. Each piece shares the owner
+    const uint8_t* p = static_cast<const uint8_t*>(data); // NOLINT(build/unsigned)
+    do {
+      std::size_t n = std::min(size, max_segment_size);
+      m_segments.push_back(Segment{ p, n });
+      m_owners.push_back(owner);
+      m_size += n;
+      p += n;
+      size -= n;
+    } while (size > 0);
+  }
+
+  /**
+   * @brief Append a segment, taking ownership of its memory
+   */
+  void append_segment(std::vector<uint8_t>&& data) // NOLINT(build/unsigned)
+  {
+    auto owner = std::make_shared<const std::vector<uint8_t>>(std::move(data)); // NOLINT(build/unsigned)
+    append_shared(owner->data(), owner->size(), owner);
+  }
+
+  const std::vector<Segment>& segments() const { return m_segments; }
+
+  DecodeMode decode_mode() const { return m_decode_mode; }
+
+  /**
+   * @brief Total size of all segments
+   */
+  std::size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  /**
+   * @brief Copy the whole payload to @p dest, which must have room for size() bytes
+   */
+  void copy_to(void* dest) const
+  {
+    uint8_t* p = static_cast<uint8_t*>(dest); // NOLINT(build/unsigned)
+    for (auto& seg : m_segments) {
+      std::memcpy(p, seg.data, seg.size);
+      p += seg.size;
+    }
+  }
+
+  /**
+   * @brief Reassemble the payload into a single contiguous buffer. Only
+   * do this if you really need it contiguous: it doubles the memory used
+   */
+  std::vector<uint8_t> to_contiguous() const // NOLINT(build/unsigned)
+  {
+    std::vector<uint8_t> ret(m_size); // NOLINT(build/unsigned)
+    copy_to(ret.data());
+    return ret;
+  }
+
+  /**
+   * @brief Remove all segments. The decode mode is kept
+   */
+  void clear()
+  {
+    m_segments.clear();
+    m_owners.clear();
+    m_size = 0;
+  }
+
+private:
+  std::vector<Segment> m_segments;
+  std::vector<std::shared_ptr<const void>> m_owners; // One per segment; null for views
+  std::size_t m_size = 0;
+  DecodeMode m_decode_mode = kCopySegments;
+};
+
+inline void
+to_json(nlohmann::json& j, const ChunkedBlob& blob)
+{
+  j = nlohmann::json::array();
+  for (auto& seg : blob.segments()) {
+    j.push_back(std::vector<uint8_t>(seg.data, seg.data + seg.size)); // NOLINT(build/unsigned)
+  }
+}
+
+inline void
+from_json(const nlohmann::json& j, ChunkedBlob& blob)
+{
+  blob.clear();
+  for (auto& seg : j) {
+    blob.append_segment(seg.get<std::vector<uint8_t>>()); // NOLINT(build/unsigned)
+  }
+}
+
+} // namespace serialization
+} // namespace dunedaq
+
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+{
+  namespace adaptor {
+
+  template<>
+  struct pack<dunedaq::serialization::ChunkedBlob>
+  {
+    template<typename Stream>
+    packer<Stream>& operator()(msgpack::packer<Stream>& o, dunedaq::serialization::ChunkedBlob const& blob) const
+    {
+      o.pack_array(static_cast<uint32_t>(blob.segments().size())); // NOLINT(build/unsigned)
+      for (auto& seg : blob.segments()) {
+        o.pack_bin(static_cast<uint32_t>(seg.size));                                          // NOLINT(build/unsigned)
+        o.pack_bin_body(reinterpret_cast<const char*>(seg.data), static_cast<uint32_t>(seg.size)); // NOLINT
+      }
+      return o;
+    }
+  };
+
+  template<>
+  struct convert<dunedaq::serialization::ChunkedBlob>
+  {
+    msgpack::object const& operator()(msgpack::object const& o, dunedaq::serialization::ChunkedBlob& blob) const
+    {
+      if (o.type != msgpack::type::ARRAY)
+        throw msgpack::type_error();
+      blob.clear();
+      // Only borrow when one of the deserialize functions says the BIN
+      // fields point into the caller's (or a decompressed) message
+      const auto& input = dunedaq::serialization::detail::input_owner();
+      const bool borrow =
+        input.borrowable && blob.decode_mode() == dunedaq::serialization::ChunkedBlob::kBorrowSegments;
+      for (uint32_t i = 0; i < o.via.array.size; ++i) { // NOLINT(build/unsigned)
+        const msgpack::object& seg = o.via.array.ptr[i];
+        if (seg.type != msgpack::type::BIN)
+          throw msgpack::type_error();
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(seg.via.bin.ptr); // NOLINT
+        if (borrow) {
+          // deserialize() unpacks BIN fields by reference, so this points into the message
+          blob.append_shared(p, seg.via.bin.size, input.owner);
+        } else {
+          // Each segment gets its own allocation, so no single
+          // allocation is ever larger than one segment
+          blob.append_segment(std::vector<uint8_t>(p, p + seg.via.bin.size)); // NOLINT(build/unsigned)
+        }
+      }
+      return o;
+    }
+  };
+
+  } // namespace adaptor
+} // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+} // namespace msgpack
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_CHUNKEDBLOB_HPP_
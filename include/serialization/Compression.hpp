@@ -0,0 +1,179 @@
+/**
+ * @file Compression.hpp
+ *
+ * Thin wrappers around the LZ4 block API and the zstd single-frame
+ * API, used for compressed messages (see CompressionMode). Each codec
+ * is only available if serialization was configured with it
+ * (SERIALIZATION_WITH_LZ4 and SERIALIZATION_WITH_ZSTD), which the
+ * serialization target passes on to its dependents by defining
+ * SERIALIZATION_HAVE_LZ4 and SERIALIZATION_HAVE_ZSTD to 1 or 0. Without
+ * the target's definitions, both are 0, and compression is unavailable
+ *
+ * Compression state is kept per thread and reused, so that
+ * compressing a message doesn't allocate a new context each time
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_COMPRESSION_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_COMPRESSION_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// These come from the serialization target, so that every translation
+// unit linked against it agrees on which codecs exist. Code that only
+// has the include path gets neither codec, rather than a guess
+#ifndef SERIALIZATION_HAVE_LZ4
+#define SERIALIZATION_HAVE_LZ4 0
+#endif
+#ifndef SERIALIZATION_HAVE_ZSTD
+#define SERIALIZATION_HAVE_ZSTD 0
+#endif
+
+#if SERIALIZATION_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#if SERIALIZATION_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace dunedaq {
+namespace serialization {
+namespace detail {
+
+/**
+ * Each codec provides:
+ *
+ * - bound(size): the largest compressed size of @p size bytes, or 0 if
+ *   the codec can't compress that much in one go
+ * - compress(src, size, dst, capacity, level): the compressed size, or
+ *   0 on failure
+ * - plausible(src, size, original_size): whether @p size compressed
+ *   bytes could decompress to @p original_size bytes. Checked before
+ *   allocating the output, so that a corrupt size can't cause a huge
+ *   allocation
+ * - decompress(src, size, dst, original_size): true if the data
+ *   decompressed to exactly @p original_size bytes
+ */
+struct Lz4Codec
+{
+  static constexpr const char* name = "LZ4";
+
+#if SERIALIZATION_HAVE_LZ4
+  static constexpr bool available = true;
+
+  static std::size_t bound(std::size_t size)
+  {
+    return size > LZ4_MAX_INPUT_SIZE ? 0 : LZ4_compressBound(static_cast<int>(size));
+  }
+
+  // @p level 0 or negative is LZ4's fast mode, with acceleration
+  // -level; positive levels use LZ4HC
+  static std::size_t compress(const uint8_t* src, // NOLINT(build/unsigned)
+                              std::size_t size,
+                              uint8_t* dst, // NOLINT(build/unsigned)
+                              std::size_t capacity,
+                              int level)
+  {
+    const char* in = reinterpret_cast<const char*>(src); // NOLINT
+    char* out = reinterpret_cast<char*>(dst);            // NOLINT
+    int n;
+    if (level <= 0) {
+      thread_local std::unique_ptr<char[]> state(new char[LZ4_sizeofState()]);
+      n = LZ4_compress_fast_extState(
+        state.get(), in, out, static_cast<int>(size), static_cast<int>(capacity), std::max(1, -level));
+    } else {
+      thread_local std::unique_ptr<char[]> state_hc(new char[LZ4_sizeofStateHC()]);
+      n = LZ4_compress_HC_extStateHC(
+        state_hc.get(), in, out, static_cast<int>(size), static_cast<int>(capacity), level);
+    }
+    return n > 0 ? static_cast<std::size_t>(n) : 0;
+  }
+
+  static bool plausible(const uint8_t* /*src*/, std::size_t size, std::size_t original_size) // NOLINT(build/unsigned)
+  {
+    // LZ4 can't compress by more than a factor of 255
+    return original_size <= LZ4_MAX_INPUT_SIZE && original_size / 255 <= size;
+  }
+
+  static bool decompress(const uint8_t* src, // NOLINT(build/unsigned)
+                         std::size_t size,
+                         uint8_t* dst, // NOLINT(build/unsigned)
+                         std::size_t original_size)
+  {
+    if (size > LZ4_MAX_INPUT_SIZE || original_size > LZ4_MAX_INPUT_SIZE)
+      return false;
+    int n = LZ4_decompress_safe(reinterpret_cast<const char*>(src), // NOLINT
+                                reinterpret_cast<char*>(dst),       // NOLINT
+                                static_cast<int>(size),
+                                static_cast<int>(original_size));
+    return n >= 0 && static_cast<std::size_t>(n) == original_size;
+  }
+#else
+  static constexpr bool available = false;
+
+  static std::size_t bound(std::size_t /*size*/) { return 0; }
+  static std::size_t compress(const uint8_t*, std::size_t, uint8_t*, std::size_t, int) { return 0; } // NOLINT
+  static bool plausible(const uint8_t*, std::size_t, std::size_t) { return false; }                  // NOLINT
+  static bool decompress(const uint8_t*, std::size_t, uint8_t*, std::size_t) { return false; }       // NOLINT
+#endif
+};
+
+struct ZstdCodec
+{
+  static constexpr const char* name = "zstd";
+
+#if SERIALIZATION_HAVE_ZSTD
+  static constexpr bool available = true;
+
+  static std::size_t bound(std::size_t size) { return ZSTD_compressBound(size); }
+
+  // @p level 0 is zstd's default level
+  static std::size_t compress(const uint8_t* src, // NOLINT(build/unsigned)
+                              std::size_t size,
+                              uint8_t* dst, // NOLINT(build/unsigned)
+                              std::size_t capacity,
+                              int level)
+  {
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(), &ZSTD_freeCCtx);
+    std::size_t n = ZSTD_compressCCtx(cctx.get(), dst, capacity, src, size, level);
+    return ZSTD_isError(n) ? 0 : n;
+  }
+
+  static bool plausible(const uint8_t* src, std::size_t size, std::size_t original_size) // NOLINT(build/unsigned)
+  {
+    // ZSTD_compressCCtx() always records the size in the frame header
+    return ZSTD_getFrameContentSize(src, size) == original_size;
+  }
+
+  static bool decompress(const uint8_t* src, // NOLINT(build/unsigned)
+                         std::size_t size,
+                         uint8_t* dst, // NOLINT(build/unsigned)
+                         std::size_t original_size)
+  {
+    thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+    std::size_t n = ZSTD_decompressDCtx(dctx.get(), dst, original_size, src, size);
+    return !ZSTD_isError(n) && n == original_size;
+  }
+#else
+  static constexpr bool available = false;
+
+  static std::size_t bound(std::size_t /*size*/) { return 0; }
+  static std::size_t compress(const uint8_t*, std::size_t, uint8_t*, std::size_t, int) { return 0; } // NOLINT
+  static bool plausible(const uint8_t*, std::size_t, std::size_t) { return false; }                  // NOLINT
+  static bool decompress(const uint8_t*, std::size_t, uint8_t*, std::size_t) { return false; }       // NOLINT
+#endif
+};
+
+} // namespace detail
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_COMPRESSION_HPP_
@@ -0,0 +1,408 @@
+/**
+ * @file DeltaEncoding.hpp
+ *
+ * Stateful delta encoding for streams of messages of the same type,
+ * where successive messages differ in only a few fields
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_DELTAENCODING_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_DELTAENCODING_HPP_
+
+#include "serialization/Serialization.hpp"
+
+#include "ers/Issue.hpp"
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+
+// clang-format off
+// Disable coverage collection LCOV_EXCL_START
+ERS_DECLARE_ISSUE(serialization,                                                  // namespace
+                  CannotDeltaEncode,                                              // issue name
+                  "Cannot delta-encode type " << t
+                  << ": it does not serialize to a MsgPack array or map",         // message
+                  ((std::string)t))                                               // attributes
+
+ERS_DECLARE_ISSUE(serialization,                                                  // namespace
+                  DeltaSequenceGap,                                               // issue name
+                  "Gap in delta stream: expected frame " << expected
+                  << " but received frame " << received,                          // message
+                  ((uint64_t)expected)((uint64_t)received))                       // attributes // NOLINT
+
+ERS_DECLARE_ISSUE(serialization,                                                  // namespace
+                  DeltaKeyframeRequired,                                          // issue name
+                  "Delta frame " << seq << " cannot be applied until a keyframe is received", // message
+                  ((uint64_t)seq))                                                // attributes // NOLINT
+
+// clang-format on
+// Re-enable coverage collection LCOV_EXCL_STOP
+
+namespace serialization {
+
+/**
+ * @brief First byte of every delta-encoded frame. Delta frames can only
+ * be decoded by a DeltaDecoder, not by deserialize()
+ */
+constexpr uint8_t delta_frame_byte = 'D'; // NOLINT(build/unsigned)
+
+namespace detail {
+
+/**
+ * @brief Parse the header of the MsgPack array or map at the start of
+ * @p data. Returns false if @p data doesn't start with an array or map
+ */
+inline bool
+read_container_header(const char* data, std::size_t size, bool& is_map, uint32_t& count, std::size_t& header_size) // NOLINT
+{
+  if (size == 0)
+    return false;
+  auto byte = [data](std::size_t i) { return static_cast<uint32_t>(static_cast<uint8_t>(data[i])); }; // NOLINT
+  uint32_t b = byte(0);                                                                                  // NOLINT
+  if (b >= 0x80 && b <= 0x9f) {
+    is_map = b < 0x90;
+    count = b & 0x0f;
+    header_size = 1;
+    return true;
+  }
+  if (b == 0xdc || b == 0xde) {
+    if (size < 3)
+      return false;
+    is_map = b == 0xde;
+    count = (byte(1) << 8) | byte(2);
+    header_size = 3;
+    return true;
+  }
+  if (b == 0xdd || b == 0xdf) {
+    if (size < 5)
+      return false;
+    is_map = b == 0xdf;
+    count = (byte(1) << 24) | (byte(2) << 16) | (byte(3) << 8) | byte(4);
+    header_size = 5;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Advance @p off past the MsgPack object that starts there,
+ * without materializing it. Returns false if the object is malformed
+ * or truncated
+ */
+inline bool
+skip_object(const char* data, std::size_t size, std::size_t& off)
+{
+  if (off >= size)
+    return false;
+  msgpack::v2::null_visitor v;
+  return msgpack::v2::parse(data, size, off, v);
+}
+
+/**
+ * @brief Split the members of the MsgPack array or map in @p data into
+ * byte ranges, one per array element or map key/value pair
+ */
+inline bool
+split_fields(const char* data,
+             std::size_t size,
+             bool& is_map,
+             std::vector<std::pair<std::size_t, std::size_t>>& ranges)
+{
+  uint32_t count = 0; // NOLINT(build/unsigned)
+  std::size_t off = 0;
+  if (!read_container_header(data, size, is_map, count, off))
+    return false;
+  ranges.clear();
+  ranges.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) { // NOLINT(build/unsigned)
+    std::size_t begin = off;
+    if (!skip_object(data, size, off))
+      return false;
+    if (is_map && !skip_object(data, size, off))
+      return false;
+    ranges.emplace_back(begin, off - begin);
+  }
+  return true;
+}
+
+} // namespace detail
+
+/**
+ * @brief Encodes a stream of objects of type @p T, sending only the
+ * fields that changed since the previous message
+ *
+ * A "field" is an element of the top-level MsgPack array that @p T
+ * serializes to (or a key/value pair, if it serializes to a map). For
+ * types made serializable with DUNE_DAQ_SERIALIZE(), these are the
+ * members listed in the macro, in order. Each frame carries a
+ * sequence number, a bitmap of the fields present, and the MsgPack
+ * encoding of those fields.
+ *
+ * Every @p keyframe_interval frames (and on the first frame, whenever
+ * the number of fields changes, or after request_keyframe()) a
+ * keyframe containing all of the fields is sent, so that a decoder
+ * which missed frames can resynchronize.
+ *
+ * Use one DeltaEncoder per stream, paired with one DeltaDecoder on
+ * the receiving end.
+ */
+template<class T>
+class DeltaEncoder
+{
+public:
+  explicit DeltaEncoder(uint64_t keyframe_interval = 100) // NOLINT(build/unsigned)
+    : m_keyframe_interval(keyframe_interval)
+  {}
+
+  /**
+   * @brief Encode @p obj relative to the previously-encoded object
+   */
+  std::vector<uint8_t> encode(const T& obj) // NOLINT(build/unsigned)
+  {
+    m_buf.clear();
+    msgpack::pack(m_buf, obj);
+
+    bool is_map = false;
+    if (!detail::split_fields(m_buf.data(), m_buf.size(), is_map, m_ranges))
+      throw CannotDeltaEncode(ERS_HERE, datatype_to_string<T>());
+
+    const std::size_t n_fields = m_ranges.size();
+    bool keyframe = m_force_keyframe || n_fields != m_fields.size() || is_map != m_is_map ||
+                    (m_keyframe_interval > 0 && m_frames_since_keyframe >= m_keyframe_interval);
+    if (keyframe) {
+      m_fields.resize(n_fields);
+      m_is_map = is_map;
+      m_frames_since_keyframe = 0;
+      m_force_keyframe = false;
+    }
+
+    std::string bitmap((n_fields + 7) / 8, '\0');
+    std::size_t changed_bytes = 0;
+    for (std::size_t i = 0; i < n_fields; ++i) {
+      const char* field = m_buf.data() + m_ranges[i].first;
+      std::size_t len = m_ranges[i].second;
+      if (keyframe || m_fields[i].size() != len || std::memcmp(m_fields[i].data(), field, len) != 0) {
+        m_fields[i].assign(field, len);
+        bitmap[i / 8] |= static_cast<char>(1 << (i % 8));
+        changed_bytes += len;
+      }
+    }
+
+    std::vector<uint8_t> ret; // NOLINT(build/unsigned)
+    ret.reserve(32 + bitmap.size() + changed_bytes);
+    ret.push_back(delta_frame_byte);
+    detail::VectorWriter<std::vector<uint8_t>> writer{ ret }; // NOLINT(build/unsigned)
+    msgpack::packer<detail::VectorWriter<std::vector<uint8_t>>> pk(writer); // NOLINT(build/unsigned)
+    pk.pack_array(5);
+    pk.pack(m_seq);
+    pk.pack(keyframe);
+    pk.pack(m_is_map);
+    pk.pack(static_cast<uint32_t>(n_fields)); // NOLINT(build/unsigned)
+    pk.pack_bin(static_cast<uint32_t>(bitmap.size())); // NOLINT(build/unsigned)
+    pk.pack_bin_body(bitmap.data(), static_cast<uint32_t>(bitmap.size())); // NOLINT(build/unsigned)
+    for (std::size_t i = 0; i < n_fields; ++i) {
+      if (bitmap[i / 8] & (1 << (i % 8)))
+        writer.write(m_fields[i].data(), m_fields[i].size());
+    }
+
+    ++m_seq;
+    ++m_frames_since_keyframe;
+    return ret;
+  }
+
+  /**
+   * @brief Make the next frame a keyframe, eg because the receiver
+   * has asked to resynchronize
+   */
+  void request_keyframe() { m_force_keyframe = true; }
+
+  /**
+   * @brief Sequence number that the next frame will carry
+   */
+  uint64_t sequence() const { return m_seq; } // NOLINT(build/unsigned)
+
+private:
+  uint64_t m_keyframe_interval;          // NOLINT(build/unsigned)
+  uint64_t m_seq = 0;                    // NOLINT(build/unsigned)
+  uint64_t m_frames_since_keyframe = 0;  // NOLINT(build/unsigned)
+  bool m_force_keyframe = true;
+  bool m_is_map = false;
+  std::vector<std::string> m_fields; // Encoding of each field as last sent
+  msgpack::sbuffer m_buf;
+  std::vector<std::pair<std::size_t, std::size_t>> m_ranges;
+};
+
+/**
+ * @brief Decodes a stream of frames produced by a DeltaEncoder<T>
+ *
+ * Frames must be passed to decode() in the order they were
+ * encoded. If a frame is missing, decode() throws DeltaSequenceGap,
+ * and then throws DeltaKeyframeRequired for every subsequent non-key
+ * frame until a keyframe arrives. The sender can be asked for one
+ * with DeltaEncoder::request_keyframe().
+ */
+template<class T>
+class DeltaDecoder
+{
+public:
+  /**
+   * @brief Apply @p frame to the current state and return the resulting object
+   */
+  template<typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+  T decode(const std::vector<CharType, Alloc>& frame)
+  {
+    if (frame.empty())
+      throw CannotDeserializeMessage(ERS_HERE);
+    if (static_cast<uint8_t>(frame[0]) != delta_frame_byte) // NOLINT(build/unsigned)
+      throw UnknownSerializationTypeByte(ERS_HERE, (char)frame[0]); // NOLINT
+
+    const char* data = reinterpret_cast<const char*>(frame.data()); // NOLINT
+    const std::size_t size = frame.size();
+
+    uint64_t seq = 0;      // NOLINT(build/unsigned)
+    bool keyframe = false;
+    bool is_map = false;
+    uint32_t n_fields = 0; // NOLINT(build/unsigned)
+    const char* bitmap = nullptr;
+    uint32_t bitmap_size = 0; // NOLINT(build/unsigned)
+    std::size_t off = 1;
+    try {
+      // The bitmap is referenced in place, not copied into the zone
+      msgpack::object_handle oh = msgpack::unpack(
+        data, size, off, [](msgpack::type::object_type, std::size_t, void*) -> bool { return true; });
+      msgpack::object header = oh.get();
+      if (header.type != msgpack::type::ARRAY || header.via.array.size != 5 ||
+          header.via.array.ptr[4].type != msgpack::type::BIN)
+        throw CannotDeserializeMessage(ERS_HERE);
+      seq = header.via.array.ptr[0].as<uint64_t>(); // NOLINT(build/unsigned)
+      keyframe = header.via.array.ptr[1].as<bool>();
+      is_map = header.via.array.ptr[2].as<bool>();
+      n_fields = header.via.array.ptr[3].as<uint32_t>(); // NOLINT(build/unsigned)
+      bitmap = header.via.array.ptr[4].via.bin.ptr;
+      bitmap_size = header.via.array.ptr[4].via.bin.size;
+    } catch (msgpack::type_error& e) {
+      throw CannotDeserializeMessage(ERS_HERE, e);
+    } catch (msgpack::unpack_error& e) {
+      throw CannotDeserializeMessage(ERS_HERE, e);
+    }
+    if (bitmap_size != (std::size_t(n_fields) + 7) / 8)
+      throw CannotDeserializeMessage(ERS_HERE);
+
+    if (!keyframe) {
+      if (!m_have_keyframe)
+        throw DeltaKeyframeRequired(ERS_HERE, seq);
+      if (seq != m_next_seq) {
+        m_have_keyframe = false;
+        throw DeltaSequenceGap(ERS_HERE, m_next_seq, seq);
+      }
+      if (n_fields != m_fields.size() || is_map != m_is_map)
+        throw CannotDeserializeMessage(ERS_HERE);
+    }
+
+    // The state is only updated once the new object has been
+    // successfully unpacked, so that a malformed frame, or one holding
+    // the wrong type, leaves the decoder as it was
+    m_changed.clear();
+    for (uint32_t i = 0; i < n_fields; ++i) { // NOLINT(build/unsigned)
+      bool present = bitmap[i / 8] & (1 << (i % 8));
+      if (!present) {
+        if (keyframe)
+          throw CannotDeserializeMessage(ERS_HERE);
+        continue;
+      }
+      std::size_t begin = off;
+      if (!detail::skip_object(data, size, off) || (is_map && !detail::skip_object(data, size, off)))
+        throw CannotDeserializeMessage(ERS_HERE);
+      m_changed.push_back({ i, begin, off - begin });
+    }
+    if (off != size)
+      throw CannotDeserializeMessage(ERS_HERE);
+
+    // Reassemble the full MsgPack encoding of the object, taking each
+    // changed field from the frame and the rest from the current state
+    m_buf.clear();
+    msgpack::packer<msgpack::sbuffer> pk(m_buf);
+    if (is_map)
+      pk.pack_map(n_fields);
+    else
+      pk.pack_array(n_fields);
+    auto changed = m_changed.begin();
+    for (uint32_t i = 0; i < n_fields; ++i) { // NOLINT(build/unsigned)
+      if (changed != m_changed.end() && changed->index == i) {
+        m_buf.write(data + changed->begin, changed->length);
+        ++changed;
+      } else {
+        m_buf.write(m_fields[i].data(), m_fields[i].size());
+      }
+    }
+
+    T ret = unpack_buffer();
+
+    if (keyframe) {
+      m_fields.resize(n_fields);
+      m_is_map = is_map;
+    }
+    for (auto& c : m_changed)
+      m_fields[c.index].assign(data + c.begin, c.length);
+    m_have_keyframe = true;
+    m_next_seq = seq + 1;
+    return ret;
+  }
+
+  /**
+   * @brief Discard the current state: the next frame must be a keyframe
+   */
+  void reset() { m_have_keyframe = false; }
+
+  /**
+   * @brief Whether the decoder has a state that delta frames can be applied to
+   */
+  bool synchronized() const { return m_have_keyframe; }
+
+private:
+  T unpack_buffer()
+  {
+    // m_buf is reused by the next frame, so nothing may borrow from it
+    detail::InputOwnerGuard no_borrow(nullptr, false);
+    try {
+      msgpack::object_handle obj_oh = msgpack::unpack(
+        m_buf.data(),
+        m_buf.size(),
+        [](msgpack::type::object_type /*typ*/, std::size_t /*length*/, void* /*user_data*/) -> bool { return true; });
+      return obj_oh.get().as<T>();
+    } catch (msgpack::type_error& e) {
+      throw CannotDeserializeMessage(ERS_HERE, e);
+    } catch (msgpack::unpack_error& e) {
+      throw CannotDeserializeMessage(ERS_HERE, e);
+    }
+  }
+
+  struct ChangedField
+  {
+    uint32_t index; // NOLINT(build/unsigned)
+    std::size_t begin;
+    std::size_t length;
+  };
+
+  bool m_have_keyframe = false;
+  bool m_is_map = false;
+  uint64_t m_next_seq = 0; // NOLINT(build/unsigned)
+  std::vector<std::string> m_fields;
+  std::vector<ChangedField> m_changed;
+  msgpack::sbuffer m_buf;
+};
+
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_DELTAENCODING_HPP_
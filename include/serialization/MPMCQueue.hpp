@@ -0,0 +1,146 @@
+/**
+ * @file MPMCQueue.hpp
+ *
+ * A bounded, lock-free, multi-producer multi-consumer queue, used to
+ * hand work between threads in the asynchronous serializer
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_MPMCQUEUE_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_MPMCQUEUE_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace dunedaq {
+namespace serialization {
+
+/**
+ * @brief Bounded lock-free MPMC queue
+ *
+ * This is Dmitry Vyukov's array-based bounded queue: each cell carries
+ * a sequence number which tells producers and consumers whether the
+ * cell is free to be written or ready to be read, so the only shared
+ * read-modify-write operations are the CASes on the enqueue and
+ * dequeue positions. The capacity is rounded up to a power of two
+ */
+template<typename T>
+class MPMCQueue
+{
+public:
+  explicit MPMCQueue(std::size_t capacity)
+    : m_capacity(round_up_pow2(capacity))
+    , m_mask(m_capacity - 1)
+    , m_cells(new Cell[m_capacity])
+  {
+    for (std::size_t i = 0; i < m_capacity; ++i) {
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MPMCQueue(const MPMCQueue&) = delete;
+  MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+  /**
+   * @brief Push @p item onto the queue if there is space. @p item is
+   * only moved from if the push succeeds
+   */
+  bool try_push(T&& item)
+  {
+    Cell* cell;
+    std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &m_cells[pos & m_mask];
+      std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false; // full
+      } else {
+        pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data.emplace(std::move(item));
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Pop the oldest item into @p item if the queue is not empty
+   */
+  bool try_pop(T& item)
+  {
+    Cell* cell;
+    std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &m_cells[pos & m_mask];
+      std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false; // empty
+      } else {
+        pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    item = std::move(*cell->data);
+    cell->data.reset();
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Number of items in the queue. Only a snapshot when other
+   * threads are pushing or popping
+   */
+  std::size_t size_approx() const
+  {
+    std::size_t enq = m_enqueue_pos.load(std::memory_order_relaxed);
+    std::size_t deq = m_dequeue_pos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+  }
+
+  bool empty_approx() const { return size_approx() == 0; }
+
+  std::size_t capacity() const { return m_capacity; }
+
+private:
+  static std::size_t round_up_pow2(std::size_t n)
+  {
+    std::size_t ret = 2;
+    while (ret < n)
+      ret <<= 1;
+    return ret;
+  }
+
+  struct Cell
+  {
+    std::atomic<std::size_t> sequence;
+    std::optional<T> data;
+  };
+
+  // Keep the two positions on separate cache lines so that producers
+  // and consumers don't falsely share
+  static constexpr std::size_t s_cache_line = 64;
+
+  std::size_t m_capacity;
+  std::size_t m_mask;
+  std::unique_ptr<Cell[]> m_cells;
+  alignas(s_cache_line) std::atomic<std::size_t> m_enqueue_pos{ 0 };
+  alignas(s_cache_line) std::atomic<std::size_t> m_dequeue_pos{ 0 };
+};
+
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_MPMCQUEUE_HPP_
@@ -12,12 +12,26 @@
 
 #include "ers/Issue.hpp"
 
+#include "serialization/Checksum.hpp"
+#include "serialization/Compression.hpp"
+#include "serialization/detail/PmrString.hpp"
+#include "serialization/detail/StringTable.hpp"
+
 #include "boost/preprocessor.hpp"
 #include "msgpack.hpp"
 #include "nlohmann/json.hpp"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <vector>
 
 #define DUNE_DAQ_TYPESTRING(Type, typestring)                                                                          \
@@ -55,6 +69,11 @@
 // NOLINTNEXTLINE(build/define_used)
 #define DUNE_DAQ_SERIALIZE(Type, ...)                                                                                  \
   MSGPACK_DEFINE(__VA_ARGS__)                                                                                          \
+  template<class Visitor>                                                                                              \
+  friend void dunedaq_serialization_fields(Visitor& v, const Type*)                                                    \
+  {                                                                                                                    \
+    BOOST_PP_SEQ_FOR_EACH(OFIELD, Type, BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__))                                         \
+  }                                                                                                                    \
   NLOHMANN_DEFINE_TYPE_INTRUSIVE(Type, __VA_ARGS__)
 
 // Helper macros for DUNE_DAQ_SERIALIZE_NON_INTRUSIVE()
@@ -62,6 +81,9 @@
 #define OPACK(r, data, elem) o.pack(m.elem);
 // NOLINTNEXTLINE
 #define OUNPACK(r, data, elem) m.elem = o.via.array.ptr[i++].as<decltype(m.elem)>();
+// Helper macro for DUNE_DAQ_SERIALIZE() and DUNE_DAQ_SERIALIZE_NON_INTRUSIVE()
+// NOLINTNEXTLINE
+#define OFIELD(r, Type, elem) v.template field<decltype(Type::elem)>(BOOST_PP_STRINGIZE(elem));
 
 /**
  * @brief Macro to make a class/struct serializable non-intrusively
@@ -86,6 +108,17 @@
 // NOLINTNEXTLINE
 #define DUNE_DAQ_SERIALIZE_NON_INTRUSIVE(NS, Type, ...)                                                                \
   DUNE_DAQ_SERIALIZABLE(NS::Type, #Type);                                                                              \
+  template<>                                                                                                           \
+  struct dunedaq::serialization::record_fields<NS::Type>                                                               \
+  {                                                                                                                    \
+    static constexpr bool value = true;                                                                                \
+    static constexpr bool fixed_size = true;                                                                           \
+    template<class Visitor>                                                                                            \
+    static void visit(Visitor& v)                                                                                      \
+    {                                                                                                                  \
+      BOOST_PP_SEQ_FOR_EACH(OFIELD, NS::Type, BOOST_PP_VARIADIC_TO_SEQ(__VA_ARGS__))                                   \
+    }                                                                                                                  \
+  };                                                                                                                   \
   namespace NS {                                                                                                       \
   NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(Type, __VA_ARGS__)                                                                \
   }                                                                                                                    \
@@ -144,6 +177,18 @@ ERS_DECLARE_ISSUE(serialization,                        // namespace
                   CannotDeserializeMessage,             // issue name
                   "Cannot deserialize message",)        // message
 
+ERS_DECLARE_ISSUE(serialization,                        // namespace
+                  ChecksumMismatch,                     // issue name
+                  "Message checksum mismatch: header says " << expected
+                  << ", computed " << computed,         // message
+                  ((uint32_t)expected)((uint32_t)computed)) // attributes // NOLINT
+
+ERS_DECLARE_ISSUE(serialization,                        // namespace
+                  CompressionUnavailable,               // issue name
+                  "Compression with " << codec
+                  << " is not available in this build", // message
+                  ((std::string)codec))                 // attributes
+
 // clang-format on
 // Re-enable coverage collection LCOV_EXCL_STOP
 
@@ -161,13 +206,202 @@ struct is_serializable : std::false_type
 {
 };
 
+namespace detail {
+
+// Stand-in visitor used to detect DUNE_DAQ_SERIALIZE types
+struct FieldVisitorProbe
+{
+  template<class U>
+  void field(const char* /*name*/)
+  {}
+};
+
+} // namespace detail
+
+/**
+ * @brief Names and types of the fields of a record: a class made
+ * serializable with DUNE_DAQ_SERIALIZE or
+ * DUNE_DAQ_SERIALIZE_NON_INTRUSIVE, which MsgPack stores as an array
+ * of its fields, and JSON as an object
+ *
+ * visit(v) calls `v.field<FieldType>(name)` for each field, in order.
+ * fixed_size says whether converting from MsgPack requires an array of
+ * exactly that many fields: msgpack-c's MSGPACK_DEFINE accepts fewer
+ * or more, but DUNE_DAQ_SERIALIZE_NON_INTRUSIVE doesn't
+ */
+template<typename T, typename Enable = void>
+struct record_fields : std::false_type
+{
+};
+
+// DUNE_DAQ_SERIALIZE defines dunedaq_serialization_fields() as a
+// friend of the class, so that it is only found by argument-dependent
+// lookup, and the class gains no members
+template<typename T>
+struct record_fields<T,
+                     std::void_t<decltype(dunedaq_serialization_fields(std::declval<detail::FieldVisitorProbe&>(),
+                                                                       static_cast<const T*>(nullptr)))>>
+  : std::true_type
+{
+  static constexpr bool fixed_size = false;
+
+  template<class Visitor>
+  static void visit(Visitor& v)
+  {
+    dunedaq_serialization_fields(v, static_cast<const T*>(nullptr));
+  }
+};
+
+namespace detail {
+
+template<typename T>
+struct is_vector : std::false_type
+{
+};
+
+template<typename T, typename Alloc>
+struct is_vector<std::vector<T, Alloc>> : std::true_type
+{
+};
+
+template<typename T>
+struct is_binary : std::false_type
+{
+};
+
+// msgpack-c packs these as BIN
+template<typename Alloc>
+struct is_binary<std::vector<char, Alloc>> : std::true_type
+{
+};
+
+template<typename Alloc>
+struct is_binary<std::vector<unsigned char, Alloc>> : std::true_type
+{
+};
+
+template<typename T>
+struct is_string : std::false_type
+{
+};
+
+template<typename Traits, typename Alloc>
+struct is_string<std::basic_string<char, Traits, Alloc>> : std::true_type
+{
+};
+
+template<typename T, typename Enable = void>
+struct is_map : std::false_type
+{
+};
+
+template<typename T>
+struct is_map<T, std::void_t<typename T::key_type, typename T::mapped_type>> : std::true_type
+{
+};
+
+template<typename T>
+struct is_optional : std::false_type
+{
+};
+
+template<typename T>
+struct is_optional<std::optional<T>> : std::true_type
+{
+};
+
+constexpr uint32_t // NOLINT(build/unsigned)
+msgpack_type_bit(msgpack::type::object_type t)
+{
+  return uint32_t(1) << t; // NOLINT(build/unsigned)
+}
+
+constexpr uint32_t any_msgpack_type = ~uint32_t(0); // NOLINT(build/unsigned)
+
+/**
+ * @brief The MsgPack types (as msgpack_type_bit()s) that msgpack-c can
+ * convert to @p T. Types it doesn't know about accept anything
+ */
+template<typename T>
+constexpr uint32_t // NOLINT(build/unsigned)
+accepted_msgpack_types()
+{
+  namespace mt = msgpack::type;
+  constexpr uint32_t integers = msgpack_type_bit(mt::POSITIVE_INTEGER) | msgpack_type_bit(mt::NEGATIVE_INTEGER); // NOLINT
+  if constexpr (std::is_same_v<T, bool>) {
+    return msgpack_type_bit(mt::BOOLEAN);
+  } else if constexpr (std::is_integral_v<T>) {
+    return integers;
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return integers | msgpack_type_bit(mt::FLOAT32) | msgpack_type_bit(mt::FLOAT64);
+  } else if constexpr (is_string<T>::value || is_binary<T>::value) {
+    return msgpack_type_bit(mt::STR) | msgpack_type_bit(mt::BIN);
+  } else if constexpr (is_vector<T>::value) {
+    return msgpack_type_bit(mt::ARRAY);
+  } else if constexpr (is_map<T>::value) {
+    return msgpack_type_bit(mt::MAP);
+  } else if constexpr (is_optional<T>::value) {
+    constexpr uint32_t value_types = accepted_msgpack_types<typename T::value_type>(); // NOLINT(build/unsigned)
+    return value_types == any_msgpack_type ? any_msgpack_type : value_types | msgpack_type_bit(mt::NIL);
+  } else if constexpr (record_fields<T>::value) {
+    return msgpack_type_bit(mt::ARRAY);
+  } else {
+    return any_msgpack_type;
+  }
+}
+
+/**
+ * @brief The MsgPack array that a record is converted from: its
+ * accepted_msgpack_types() for each field
+ */
+struct RecordShape
+{
+  bool fixed_size = false;
+  std::vector<uint32_t> fields; // NOLINT(build/unsigned)
+};
+
+struct RecordShapeBuilder
+{
+  RecordShape& shape;
+
+  template<class U>
+  void field(const char* /*name*/)
+  {
+    shape.fields.push_back(accepted_msgpack_types<std::decay_t<U>>());
+  }
+};
+
+/**
+ * @brief The shape of record type @p T, or null if @p T isn't a record
+ */
+template<typename T>
+const RecordShape*
+record_shape()
+{
+  if constexpr (record_fields<T>::value) {
+    static const RecordShape shape = [] {
+      RecordShape ret;
+      ret.fixed_size = record_fields<T>::fixed_size;
+      RecordShapeBuilder builder{ ret };
+      record_fields<T>::visit(builder);
+      return ret;
+    }();
+    return &shape;
+  } else {
+    return nullptr;
+  }
+}
+
+} // namespace detail
+
 /**
  * @brief Serialization methods that are available
  */
 enum SerializationType
 {
   kJSON,
-  kMsgPack
+  kMsgPack,
+  kMsgPackInterned ///< MsgPack, with repeated strings sent as references to their first occurrence
 };
 
 /**
@@ -180,6 +414,8 @@ from_string(const std::string s)
     return kJSON;
   if (s == "msgpack")
     return kMsgPack;
+  if (s == "msgpack_interned")
+    return kMsgPackInterned;
   throw UnknownSerializationTypeString(ERS_HERE, s);
 }
 
@@ -191,95 +427,1095 @@ serialization_type_byte(SerializationType stype)
       return 'J';
     case kMsgPack:
       return 'M';
+    case kMsgPackInterned:
+      return 'I';
     default:
       throw UnknownSerializationTypeEnum(ERS_HERE);
   }
 }
 
 /**
- * @brief Serialize object @p obj using serialization method @p stype
+ * @brief Integrity checks that can be added to a serialized message
+ */
+enum ChecksumMode
+{
+  kNoChecksum,
+  kCRC32C ///< CRC32C of the message, checked by deserialize() before parsing
+};
+
+/**
+ * @brief Format byte of a message with a checksum. It is followed by
+ * the 4-byte little-endian checksum, then by the message itself,
+ * starting with its own format byte
+ */
+constexpr uint8_t checksum_type_byte = 'C'; // NOLINT(build/unsigned)
+
+constexpr std::size_t checksum_header_size = 5;
+
+/**
+ * @brief Compression that can be applied to a serialized message
+ */
+enum CompressionMode
+{
+  kNoCompression,
+  kLZ4, ///< Fast compression and decompression, for latency-sensitive links
+  kZstd ///< Slower, but a better compression ratio, for bandwidth- or storage-limited links
+};
+
+/**
+ * @brief Format bytes of compressed messages. They are followed by the
+ * 8-byte little-endian size of the uncompressed message, then by the
+ * compressed message, which starts with its own format byte
+ */
+constexpr uint8_t lz4_type_byte = 'L';  // NOLINT(build/unsigned)
+constexpr uint8_t zstd_type_byte = 'Z'; // NOLINT(build/unsigned)
+
+constexpr std::size_t compression_header_size = 9;
+
+/**
+ * @brief Options controlling serialize() and serialize_into()
+ */
+struct SerializationOptions
+{
+  ChecksumMode checksum = kNoChecksum;
+
+  CompressionMode compression = kNoCompression;
+
+  /**
+   * @brief Messages smaller than this many bytes are sent uncompressed,
+   * since compressing them costs more time than it saves on the wire
+   */
+  std::size_t compression_threshold = 4096;
+
+  /**
+   * @brief Codec-specific compression level. 0 is the codec's default.
+   * For LZ4, negative levels trade ratio for speed, and positive ones
+   * select LZ4HC; for zstd, the level is passed through
+   */
+  int compression_level = 0;
+};
+
+namespace detail {
+
+/**
+ * @brief MsgPack output stream that appends to a std::vector of bytes
+ */
+template<class Vector>
+struct VectorWriter
+{
+  Vector& vec;
+
+  void write(const char* buf, size_t len)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buf); // NOLINT
+    vec.insert(vec.end(), p, p + len);
+  }
+};
+
+/**
+ * @brief MsgPack output stream that just counts the bytes written to it
+ */
+struct CountingWriter
+{
+  std::size_t size = 0;
+
+  void write(const char* /*buf*/, size_t len) { size += len; }
+};
+
+} // namespace detail
+
+/**
+ * @brief Number of bytes in the message produced by serializing @p obj
+ * with kMsgPack. This packs the object without storing the result,
+ * so it's only worth calling for large objects, to size a buffer
+ * exactly before calling serialize_into()
  */
 template<class T>
-std::vector<uint8_t> // NOLINT(build/unsigned)
-serialize(const T& obj, SerializationType stype)
+std::size_t
+packed_size(const T& obj)
+{
+  detail::CountingWriter writer;
+  msgpack::pack(writer, obj);
+  return writer.size + 1;
+}
+
+namespace detail {
+
+/**
+ * @brief Append the serialization of @p obj, starting with its format byte, to @p out
+ */
+template<class T, class Alloc>
+void
+serialize_append(const T& obj, SerializationType stype, std::vector<uint8_t, Alloc>& out) // NOLINT(build/unsigned)
 {
+  out.push_back(serialization_type_byte(stype));
   switch (stype) {
     case kJSON: {
       nlohmann::json j = obj;
       nlohmann::json::string_t s = j.dump();
-      std::vector<uint8_t> ret(s.size() + 1); // NOLINT(build/unsigned)
-      ret[0] = serialization_type_byte(stype);
-      std::copy(s.begin(), s.end(), ret.begin() + 1); // NOLINT
-      return ret;
+      out.insert(out.end(), s.begin(), s.end());
+      break;
     }
     case kMsgPack: {
-      // Serialize into the sbuffer and then copy to a
-      // std::vector. Seems like it would be more efficient to
-      // write directly to the vector (by creating a class that
-      // implements `void write(char* buf, size_t len)`), but my
-      // tests aren't any faster than this
+      VectorWriter<std::vector<uint8_t, Alloc>> writer{ out }; // NOLINT(build/unsigned)
+      msgpack::pack(writer, obj);
+      break;
+    }
+    case kMsgPackInterned: {
+      // Pack as usual, then repack with repeated strings replaced. The
+      // strings in the unpacked object point into buf, so the
+      // dictionary doesn't need to copy them
       msgpack::sbuffer buf;
       msgpack::pack(buf, obj);
-      std::vector<uint8_t> ret(buf.size() + 1); // NOLINT(build/unsigned)
-      ret[0] = serialization_type_byte(stype);
-      std::copy(buf.data(), buf.data() + buf.size(), ret.begin() + 1); // NOLINT
-      return ret;
+      msgpack::object_handle oh =
+        msgpack::unpack(buf.data(), buf.size(), [](msgpack::type::object_type, std::size_t, void*) -> bool { return true; });
+      InternDictionary dict(SIZE_MAX, false);
+      VectorWriter<std::vector<uint8_t, Alloc>> writer{ out }; // NOLINT(build/unsigned)
+      msgpack::packer<VectorWriter<std::vector<uint8_t, Alloc>>> pk(writer); // NOLINT(build/unsigned)
+      dict.pack(pk, oh.get());
+      break;
     }
     default:
       throw UnknownSerializationTypeEnum(ERS_HERE);
   }
 }
 
+inline void
+write_le32(uint8_t* p, uint32_t v) // NOLINT(build/unsigned)
+{
+  for (int i = 0; i < 4; ++i)
+    p[i] = static_cast<uint8_t>(v >> (8 * i)); // NOLINT(build/unsigned)
+}
+
+inline uint32_t             // NOLINT(build/unsigned)
+read_le32(const uint8_t* p) // NOLINT(build/unsigned)
+{
+  uint32_t v = 0; // NOLINT(build/unsigned)
+  for (int i = 0; i < 4; ++i)
+    v |= static_cast<uint32_t>(p[i]) << (8 * i); // NOLINT(build/unsigned)
+  return v;
+}
+
+inline void
+write_le64(uint8_t* p, uint64_t v) // NOLINT(build/unsigned)
+{
+  for (int i = 0; i < 8; ++i)
+    p[i] = static_cast<uint8_t>(v >> (8 * i)); // NOLINT(build/unsigned)
+}
+
+inline uint64_t             // NOLINT(build/unsigned)
+read_le64(const uint8_t* p) // NOLINT(build/unsigned)
+{
+  uint64_t v = 0; // NOLINT(build/unsigned)
+  for (int i = 0; i < 8; ++i)
+    v |= static_cast<uint64_t>(p[i]) << (8 * i); // NOLINT(build/unsigned)
+  return v;
+}
+
 /**
- * @brief Deserialize vector of bytes @p v into an instance of class @p T
+ * @brief Per-thread copy of the message being compressed, so that it
+ * can be compressed straight back into the caller's buffer
  */
-template<class T, typename CharType = unsigned char>
-T
-deserialize(const std::vector<CharType>& v)
+inline std::vector<uint8_t>& // NOLINT(build/unsigned)
+compression_scratch()
+{
+  thread_local std::vector<uint8_t> scratch; // NOLINT(build/unsigned)
+  return scratch;
+}
+
+/**
+ * @brief Replace the message that starts at @p start in @p out with its
+ * compressed form, unless it's below the size threshold in @p options
+ * or compressing doesn't make it smaller
+ */
+template<class Codec, class Alloc>
+void
+compress_tail(std::vector<uint8_t, Alloc>& out, // NOLINT(build/unsigned)
+              std::size_t start,
+              uint8_t type_byte, // NOLINT(build/unsigned)
+              const SerializationOptions& options)
+{
+  if constexpr (!Codec::available) {
+    throw CompressionUnavailable(ERS_HERE, Codec::name);
+  } else {
+    const std::size_t size = out.size() - start;
+    if (size < options.compression_threshold)
+      return;
+    const std::size_t bound = Codec::bound(size);
+    if (bound == 0) // Too large for the codec to compress in one go
+      return;
+
+    std::vector<uint8_t>& scratch = compression_scratch(); // NOLINT(build/unsigned)
+    scratch.assign(out.begin() + start, out.end());
+    out.resize(start + compression_header_size + bound);
+    uint8_t* dst = out.data() + start + compression_header_size; // NOLINT(build/unsigned)
+    std::size_t n = Codec::compress(scratch.data(), size, dst, bound, options.compression_level);
+    if (n == 0 || n + compression_header_size >= size) {
+      // Incompressible: put the original back
+      out.resize(start);
+      out.insert(out.end(), scratch.begin(), scratch.end());
+    } else {
+      out.resize(start + compression_header_size + n);
+      out[start] = type_byte;
+      write_le64(&out[start + 1], size);
+    }
+    // Don't hold on to the memory of an unusually large message for the
+    // life of the thread
+    if (scratch.capacity() > (std::size_t(64) << 20))
+      std::vector<uint8_t>().swap(scratch); // NOLINT(build/unsigned)
+  }
+}
+
+/**
+ * @brief Number of bytes to leave before the message for the checksum
+ * requested in @p options, to be filled in by wrap_message()
+ */
+inline std::size_t
+envelope_header_size(const SerializationOptions& options)
+{
+  switch (options.checksum) {
+    case kNoChecksum:
+      return 0;
+    case kCRC32C:
+      return checksum_header_size;
+    default:
+      throw UnknownSerializationTypeEnum(ERS_HERE);
+  }
+}
+
+/**
+ * @brief Compress the plain message that starts at @p start in @p out,
+ * and fill in the checksum before it, as requested in @p options
+ */
+template<class Alloc>
+void
+wrap_message(std::vector<uint8_t, Alloc>& out, // NOLINT(build/unsigned)
+             std::size_t start,
+             const SerializationOptions& options)
+{
+  // Compress first, so that the checksum covers the bytes actually sent
+  switch (options.compression) {
+    case kNoCompression:
+      break;
+    case kLZ4:
+      compress_tail<Lz4Codec>(out, start, lz4_type_byte, options);
+      break;
+    case kZstd:
+      compress_tail<ZstdCodec>(out, start, zstd_type_byte, options);
+      break;
+    default:
+      throw UnknownSerializationTypeEnum(ERS_HERE);
+  }
+
+  if (options.checksum == kCRC32C) {
+    out[0] = checksum_type_byte;
+    write_le32(&out[1], crc32c(out.data() + checksum_header_size, out.size() - checksum_header_size));
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief Serialize object @p obj using serialization method @p stype,
+ * writing the result into @p out
+ *
+ * The contents of @p out are replaced, but its capacity is kept, so
+ * callers that reuse the same buffer for many messages avoid an
+ * allocation per message
+ */
+template<class T, class Alloc>
+void
+serialize_into(const T& obj,
+               SerializationType stype,
+               std::vector<uint8_t, Alloc>& out, // NOLINT(build/unsigned)
+               const SerializationOptions& options = SerializationOptions())
+{
+  const std::size_t start = detail::envelope_header_size(options);
+  out.clear();
+  out.resize(start);
+  detail::serialize_append(obj, stype, out);
+  detail::wrap_message(out, start, options);
+}
+
+/**
+ * @brief Serialize object @p obj using serialization method @p stype
+ */
+template<class T>
+std::vector<uint8_t> // NOLINT(build/unsigned)
+serialize(const T& obj, SerializationType stype, const SerializationOptions& options = SerializationOptions())
+{
+  if (options.checksum == kNoChecksum && options.compression == kNoCompression) {
+    switch (stype) {
+      case kJSON: {
+        nlohmann::json j = obj;
+        nlohmann::json::string_t s = j.dump();
+        std::vector<uint8_t> ret(s.size() + 1); // NOLINT(build/unsigned)
+        ret[0] = serialization_type_byte(stype);
+        std::copy(s.begin(), s.end(), ret.begin() + 1); // NOLINT
+        return ret;
+      }
+      case kMsgPack: {
+        // Serialize into the sbuffer and then copy to a
+        // std::vector. Seems like it would be more efficient to
+        // write directly to the vector (by creating a class that
+        // implements `void write(char* buf, size_t len)`), but my
+        // tests aren't any faster than this
+        msgpack::sbuffer buf;
+        msgpack::pack(buf, obj);
+        std::vector<uint8_t> ret(buf.size() + 1); // NOLINT(build/unsigned)
+        ret[0] = serialization_type_byte(stype);
+        std::copy(buf.data(), buf.data() + buf.size(), ret.begin() + 1); // NOLINT
+        return ret;
+      }
+      default:
+        break;
+    }
+  }
+  std::vector<uint8_t> ret; // NOLINT(build/unsigned)
+  serialize_into(obj, stype, ret, options);
+  return ret;
+}
+
+/**
+ * @brief Serialize object @p obj using serialization method @p stype,
+ * into a vector whose memory comes from @p resource
+ *
+ * With a std::pmr::monotonic_buffer_resource per event, all of the
+ * event's messages are freed at once when the resource is released.
+ * For JSON, the intermediate nlohmann::json document still uses the
+ * default allocator
+ */
+template<class T>
+std::pmr::vector<uint8_t> // NOLINT(build/unsigned)
+serialize_pmr(const T& obj,
+              SerializationType stype,
+              std::pmr::memory_resource* resource,
+              const SerializationOptions& options = SerializationOptions())
+{
+  std::pmr::vector<uint8_t> ret(resource); // NOLINT(build/unsigned)
+  serialize_into(obj, stype, ret, options);
+  return ret;
+}
+
+/**
+ * @brief Options controlling deserialize() and try_deserialize()
+ */
+struct DeserializationOptions
+{
+  /**
+   * @brief Limits on the number of elements in MsgPack arrays and
+   * maps, the sizes of STR, BIN and EXT fields, and the nesting depth,
+   * beyond which deserialization fails. The defaults are msgpack's,
+   * which are effectively unlimited. Tighten them when decoding
+   * untrusted input, so that a corrupt length can't cause a huge
+   * allocation
+   */
+  msgpack::unpack_limit unpack_limit;
+
+  /**
+   * @brief Whether to verify the checksum of messages that have one
+   * (see ChecksumMode). Skipping verification saves the time taken to
+   * checksum the message, eg when it came from a trusted local source
+   */
+  bool verify_checksum = true;
+
+  /**
+   * @brief Zone in which to build the intermediate MsgPack object
+   * tree. By default, each call allocates a new zone and frees it on
+   * return. Passing a long-lived zone, and calling its clear() between
+   * events, instead reuses the same memory for every message
+   */
+  msgpack::zone* zone = nullptr;
+
+  /**
+   * @brief Largest uncompressed size accepted for a compressed message
+   * (see CompressionMode). The uncompressed message is allocated in one
+   * piece before decompressing, so a small message can claim a huge
+   * size. The default is 1 GiB; raise it for bigger messages from a
+   * trusted source, and lower it for untrusted input
+   */
+  std::size_t max_decompressed_size = std::size_t(1) << 30;
+
+  /**
+   * @brief Whether to reject a MsgPack message with bytes after the end
+   * of its object, which msgpack ignores. deserialize() then throws
+   * CannotDeserializeMessage, and try_deserialize() returns
+   * kSizeMismatch
+   */
+  bool reject_trailing_bytes = false;
+};
+
+namespace detail {
+
+/**
+ * @brief The message being deserialized on this thread, as seen by
+ * types that borrow from it, like ChunkedBlob in kBorrowSegments mode
+ */
+struct InputOwner
+{
+  /// Whether BIN fields point into a message that may be borrowed from.
+  /// Only the deserialize functions set this; decoders that unpack from
+  /// their own reused buffers leave it false, so borrowing types copy
+  bool borrowable = false;
+  /// Owner of the message, if deserialization allocated it (a
+  /// decompressed message), or null if the caller owns it. Borrowing
+  /// types share ownership of it
+  std::shared_ptr<const void> owner;
+};
+
+inline InputOwner&
+input_owner()
+{
+  thread_local InputOwner input;
+  return input;
+}
+
+/**
+ * @brief Set input_owner() for the lifetime of the guard
+ */
+class InputOwnerGuard
+{
+public:
+  explicit InputOwnerGuard(std::shared_ptr<const void> owner, bool borrowable = true)
+    : m_previous(std::exchange(input_owner(), InputOwner{ borrowable, std::move(owner) }))
+  {}
+  ~InputOwnerGuard() { input_owner() = std::move(m_previous); }
+
+  InputOwnerGuard(const InputOwnerGuard&) = delete;
+  InputOwnerGuard& operator=(const InputOwnerGuard&) = delete;
+
+private:
+  InputOwner m_previous;
+};
+
+/**
+ * @brief The `unpack_reference_func` used for all unpacking, as
+ * described at
+ * https://github.com/msgpack/msgpack-c/wiki/v2_0_cpp_unpacker#memory-management
+ *
+ * It is called for every STR, BIN and EXT field in the MsgPack
+ * data. If the function returns false, the object is copied into
+ * MsgPack's "zone", otherwise a pointer to the original buffer is
+ * stored. Our input buffer is going to exist at least until the end of
+ * deserialization, so it's safe to return true (ie, store a pointer in
+ * the MsgPack object; no copy) everywhere. Doing so results in a factor
+ * ~2 speedup in deserializing Fragment, which is just a large BIN field
+ */
+inline bool
+reference_input(msgpack::type::object_type /*typ*/, std::size_t /*length*/, void* /*user_data*/)
+{
+  return true;
+}
+
+/**
+ * @brief Unpack the MsgPack message at @p data into a msgpack::object,
+ * allocated in options.zone if set, and in @p oh otherwise. As with
+ * msgpack::unpack(), any bytes after the object are ignored, unless
+ * options.reject_trailing_bytes is set
+ */
+inline msgpack::object
+unpack_msgpack(const char* data, std::size_t size, const DeserializationOptions& options, msgpack::object_handle& oh)
+{
+  std::size_t off = 0;
+  msgpack::object obj;
+  if (options.zone) {
+    obj = msgpack::unpack(*options.zone, data, size, off, reference_input, nullptr, options.unpack_limit);
+  } else {
+    oh = msgpack::unpack(data, size, off, reference_input, nullptr, options.unpack_limit);
+    obj = oh.get();
+  }
+  if (options.reject_trailing_bytes && off != size)
+    throw CannotDeserializeMessage(ERS_HERE);
+  return obj;
+}
+
+/**
+ * @brief Decoder for deserialize_impl() that returns a new object, so
+ * that @p T needn't be default constructible
+ */
+template<class T>
+struct ConstructValue
+{
+  using result_type = T;
+
+  T operator()(const nlohmann::json& j) const { return j.get<T>(); }
+  T operator()(const msgpack::object& o) const { return o.as<T>(); }
+};
+
+/**
+ * @brief Decoder for deserialize_impl() that assigns to the members of
+ * an existing object
+ */
+template<class T>
+struct AssignTo
+{
+  using result_type = void;
+
+  T& out;
+
+  void operator()(const nlohmann::json& j) const { j.get_to(out); }
+  void operator()(const msgpack::object& o) const { o.convert(out); }
+};
+
+template<class Decoder>
+typename Decoder::result_type
+deserialize_impl(const uint8_t* data, // NOLINT(build/unsigned)
+                 std::size_t size,
+                 const DeserializationOptions& options,
+                 const Decoder& decode);
+
+/**
+ * @brief Allocate the buffer for a decompressed message. Returns null
+ * if there isn't enough memory
+ */
+inline std::shared_ptr<uint8_t[]> // NOLINT(build/unsigned)
+allocate_decompressed(std::size_t size)
+{
+  try {
+    return std::shared_ptr<uint8_t[]>(new uint8_t[size]); // NOLINT(build/unsigned)
+  } catch (std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+/**
+ * @brief Whether the decompressed message at @p data can be deserialized.
+ * serialize() compresses before adding a checksum, so a compressed
+ * message never holds a checksummed or compressed one; rejecting those
+ * stops a small message from nesting arbitrarily
+ */
+inline bool
+valid_decompressed_message(const uint8_t* data) // NOLINT(build/unsigned)
+{
+  return data[0] != checksum_type_byte && data[0] != lz4_type_byte && data[0] != zstd_type_byte;
+}
+
+/**
+ * @brief Decompress the compressed message at @p data into a new buffer
+ * of exactly the right size, which is set in @p inner_size. Returns
+ * null if the message is corrupt, decompresses to more than
+ * options.max_decompressed_size, or doesn't hold a plain message
+ */
+template<class Codec>
+std::shared_ptr<uint8_t[]> // NOLINT(build/unsigned)
+decompress_message(const uint8_t* data, // NOLINT(build/unsigned)
+                   std::size_t size,
+                   const DeserializationOptions& options,
+                   std::size_t& inner_size)
+{
+  if constexpr (!Codec::available) {
+    throw CompressionUnavailable(ERS_HERE, Codec::name);
+  } else {
+    if (size <= compression_header_size)
+      return nullptr;
+    const uint8_t* src = data + compression_header_size; // NOLINT(build/unsigned)
+    const std::size_t src_size = size - compression_header_size;
+    const uint64_t claimed_size = read_le64(data + 1); // NOLINT(build/unsigned)
+    if (claimed_size == 0 || claimed_size > options.max_decompressed_size ||
+        !Codec::plausible(src, src_size, claimed_size))
+      return nullptr;
+    inner_size = claimed_size;
+    std::shared_ptr<uint8_t[]> inner = allocate_decompressed(inner_size); // NOLINT(build/unsigned)
+    if (!inner || !Codec::decompress(src, src_size, inner.get(), inner_size) ||
+        !valid_decompressed_message(inner.get()))
+      return nullptr;
+    return inner;
+  }
+}
+
+/**
+ * @brief Decompress the compressed message at @p data, then deserialize
+ * the message inside it with @p decode
+ */
+template<class Codec, class Decoder>
+typename Decoder::result_type
+decompress_and_deserialize(const uint8_t* data, // NOLINT(build/unsigned)
+                           std::size_t size,
+                           const DeserializationOptions& options,
+                           const Decoder& decode)
+{
+  // The decoder reads the decompressed message in place. Anything that
+  // borrows from the message keeps the buffer alive
+  std::size_t inner_size = 0;
+  std::shared_ptr<uint8_t[]> inner = decompress_message<Codec>(data, size, options, inner_size); // NOLINT
+  if (!inner)
+    throw CannotDeserializeMessage(ERS_HERE);
+  InputOwnerGuard guard(inner);
+  return deserialize_impl(inner.get(), inner_size, options, decode);
+}
+
+template<class Decoder>
+typename Decoder::result_type
+deserialize_impl(const uint8_t* data, // NOLINT(build/unsigned)
+                 std::size_t size,
+                 const DeserializationOptions& options,
+                 const Decoder& decode)
 {
   using json = nlohmann::json;
 
+  if (size == 0)
+    throw CannotDeserializeMessage(ERS_HERE);
+
   // The first byte in the array indicates the serialization format;
   // the rest is the actual message
-  switch (v[0]) {
+  switch (data[0]) {
     case serialization_type_byte(kJSON): {
       try {
-        json j = json::parse(v.begin() + 1, v.end());
-        return j.get<T>();
+        json j = json::parse(data + 1, data + size);
+        return decode(j);
       } catch (json::exception& e) {
         throw CannotDeserializeMessage(ERS_HERE, e);
       }
     }
-    case serialization_type_byte(kMsgPack): {
+    case serialization_type_byte(kMsgPack):
+    case serialization_type_byte(kMsgPackInterned): {
       try {
-        // The lambda function here is of type `unpack_reference_func`
-        // as described at
-        // https://github.com/msgpack/msgpack-c/wiki/v2_0_cpp_unpacker#memory-management
-        // . It is called for every STR, BIN and EXT field in the
-        // MsgPack data. If the function returns false, the object is
-        // copied into MsgPack's "zone", otherwise a pointer to the
-        // original buffer is stored. Our input buffer is going to exist
-        // at least until the end of this function, so it's safe to
-        // return true (ie, store a pointer in the MsgPack object; no
-        // copy) everywhere. Doing so results in a factor ~2 speedup in
-        // deserializing Fragment, which is just a large BIN field
-        msgpack::object_handle oh = msgpack::unpack(
-          const_cast<char*>(reinterpret_cast<const char*>(v.data() + 1)),
-          v.size() - 1,
-          [](msgpack::type::object_type /*typ*/, std::size_t /*length*/, void* /*user_data*/) -> bool { return true; });
-        msgpack::object obj = oh.get();
-        return obj.as<T>();
+        msgpack::object_handle oh;
+        msgpack::object obj = unpack_msgpack(reinterpret_cast<const char*>(data + 1), size - 1, options, oh); // NOLINT
+        if (data[0] == serialization_type_byte(kMsgPackInterned)) {
+          // Strings are referenced in the input buffer rather than
+          // copied, so the dictionary can refer to them too
+          InternTable table(SIZE_MAX, false);
+          if (!table.resolve(obj))
+            throw CannotDeserializeMessage(ERS_HERE);
+        }
+        return decode(obj);
       } catch (msgpack::type_error& e) {
         throw CannotDeserializeMessage(ERS_HERE, e);
       } catch (msgpack::unpack_error& e) {
         throw CannotDeserializeMessage(ERS_HERE, e);
       }
     }
+    case checksum_type_byte: {
+      // serialize() never wraps a checksummed message in another
+      // checksum, and allowing it would let a message nest arbitrarily
+      if (size <= checksum_header_size || data[checksum_header_size] == checksum_type_byte)
+        throw CannotDeserializeMessage(ERS_HERE);
+      if (options.verify_checksum) {
+        uint32_t expected = read_le32(data + 1); // NOLINT(build/unsigned)
+        uint32_t computed = crc32c(data + checksum_header_size, size - checksum_header_size); // NOLINT(build/unsigned)
+        if (expected != computed)
+          throw ChecksumMismatch(ERS_HERE, expected, computed);
+      }
+      return deserialize_impl(data + checksum_header_size, size - checksum_header_size, options, decode);
+    }
+    case lz4_type_byte:
+      return decompress_and_deserialize<Lz4Codec>(data, size, options, decode);
+    case zstd_type_byte:
+      return decompress_and_deserialize<ZstdCodec>(data, size, options, decode);
+    default:
+      throw UnknownSerializationTypeByte(ERS_HERE, (char)data[0]); // NOLINT
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief Deserialize vector of bytes @p v into an instance of class @p T
+ *
+ * If the message has a checksum, it is verified before the message is
+ * parsed (unless @p options says not to), and ChecksumMismatch is
+ * thrown if it doesn't match. Compressed messages are decompressed
+ * first; CompressionUnavailable is thrown if this build doesn't have
+ * the codec
+ */
+template<class T, typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+T
+deserialize(const std::vector<CharType, Alloc>& v, const DeserializationOptions& options = DeserializationOptions())
+{
+  detail::InputOwnerGuard guard(nullptr);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(v.data()); // NOLINT
+  return detail::deserialize_impl(data, v.size(), options, detail::ConstructValue<T>());
+}
+
+/**
+ * @brief Deserialize vector of bytes @p v into the existing object @p out
+ *
+ * Members of @p out are assigned to rather than replaced, so containers
+ * keep their allocators. This is how to fill a type whose members use
+ * std::pmr allocators from a particular memory resource
+ */
+template<class T, typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+void
+deserialize_into(const std::vector<CharType, Alloc>& v,
+                 T& out,
+                 const DeserializationOptions& options = DeserializationOptions())
+{
+  detail::InputOwnerGuard guard(nullptr);
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(v.data()); // NOLINT
+  detail::deserialize_impl(data, v.size(), options, detail::AssignTo<T>{ out });
+}
+
+/**
+ * @brief Deserialize vector of bytes @p v into an instance of class
+ * @p T whose memory comes from @p resource
+ *
+ * @p T must be allocator-aware: a std::pmr container, or a class that
+ * has an `allocator_type` and a constructor taking one, which it
+ * passes on to its members
+ */
+template<class T, typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+T
+deserialize_pmr(const std::vector<CharType, Alloc>& v,
+                std::pmr::memory_resource* resource,
+                const DeserializationOptions& options = DeserializationOptions())
+{
+  using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+  static_assert(std::uses_allocator_v<T, allocator_type>, "T must be constructible with a std::pmr allocator");
+  allocator_type alloc(resource);
+  if constexpr (std::is_constructible_v<T, std::allocator_arg_t, allocator_type>) {
+    T ret(std::allocator_arg, alloc);
+    deserialize_into(v, ret, options);
+    return ret;
+  } else {
+    T ret(alloc);
+    deserialize_into(v, ret, options);
+    return ret;
+  }
+}
+
+/**
+ * @brief Reasons that try_deserialize() can fail
+ */
+enum DeserializationError
+{
+  kBadFormatByte, ///< The first byte isn't a known serialization type
+  kTruncated,     ///< The message ends part-way through an object
+  kMalformed,     ///< The message isn't valid in its serialization format
+  kTypeMismatch,  ///< The message is valid, but doesn't hold the requested type
+  kSizeMismatch,    ///< There are extra bytes after the end of the object (only with DeserializationOptions::reject_trailing_bytes)
+  kLimitExceeded,   ///< The message exceeds the DeserializationOptions limits
+  kChecksumMismatch, ///< The message's checksum doesn't match its contents
+  kCompressionError  ///< The message is compressed, and can't be decompressed (corrupt, or codec unavailable)
+};
+
+inline const char*
+to_string(DeserializationError err)
+{
+  switch (err) {
+    case kBadFormatByte:
+      return "bad format byte";
+    case kTruncated:
+      return "truncated";
+    case kMalformed:
+      return "malformed";
+    case kTypeMismatch:
+      return "type mismatch";
+    case kSizeMismatch:
+      return "size mismatch";
+    case kLimitExceeded:
+      return "limit exceeded";
+    case kChecksumMismatch:
+      return "checksum mismatch";
+    case kCompressionError:
+      return "compression error";
+  }
+  return "unknown";
+}
+
+/**
+ * @brief The result of try_deserialize(): either an instance of @p T
+ * or the reason that deserialization failed
+ */
+template<class T>
+class DeserializationResult
+{
+public:
+  DeserializationResult(T&& value) // NOLINT(runtime/explicit)
+    : m_result(std::in_place_index<0>, std::move(value))
+  {}
+  DeserializationResult(DeserializationError err) // NOLINT(runtime/explicit)
+    : m_result(std::in_place_index<1>, err)
+  {}
+
+  bool has_value() const { return m_result.index() == 0; }
+  explicit operator bool() const { return has_value(); }
+
+  /**
+   * @brief The deserialized object. Throws CannotDeserializeMessage if
+   * deserialization failed
+   */
+  T& value()
+  {
+    if (!has_value())
+      throw CannotDeserializeMessage(ERS_HERE);
+    return std::get<0>(m_result);
+  }
+  const T& value() const
+  {
+    if (!has_value())
+      throw CannotDeserializeMessage(ERS_HERE);
+    return std::get<0>(m_result);
+  }
+
+  T& operator*() { return std::get<0>(m_result); }
+  const T& operator*() const { return std::get<0>(m_result); }
+  T* operator->() { return &std::get<0>(m_result); }
+  const T* operator->() const { return &std::get<0>(m_result); }
+
+  /**
+   * @brief The reason deserialization failed. Only meaningful if has_value() is false
+   */
+  DeserializationError error() const { return std::get<1>(m_result); }
+
+private:
+  std::variant<T, DeserializationError> m_result;
+};
+
+namespace detail {
+
+/**
+ * @brief Checks that a MsgPack message can be unpacked within an
+ * unpack_limit, without building anything, and records why it can't
+ * instead of throwing. It applies the same limits as msgpack::unpack(),
+ * so that a message it accepts unpacks without an exception
+ *
+ * It also checks the types of the top-level object and, for a record,
+ * of its fields, against those that the requested type can be
+ * converted from. A message holding a different type is then usually
+ * reported as kTypeMismatch without converting it
+ */
+class MessageValidator : public msgpack::null_visitor
+{
+public:
+  /**
+   * @param top_types accepted_msgpack_types() of the requested type
+   * @param shape record_shape() of the requested type
+   * @param interned Whether strings may be references to interned strings
+   */
+  MessageValidator(const msgpack::unpack_limit& limit,
+                   uint32_t top_types, // NOLINT(build/unsigned)
+                   const RecordShape* shape,
+                   bool interned)
+    : m_limit(limit)
+    , m_top_types(top_types)
+    , m_shape(shape)
+    , m_interned(interned)
+  {}
+
+  DeserializationError error() const { return m_error; }
+
+  bool visit_nil() { return expect(msgpack::type::NIL); }
+  bool visit_boolean(bool /*v*/) { return expect(msgpack::type::BOOLEAN); }
+  bool visit_positive_integer(uint64_t /*v*/) { return expect(msgpack::type::POSITIVE_INTEGER); } // NOLINT
+  bool visit_negative_integer(int64_t /*v*/) { return expect(msgpack::type::NEGATIVE_INTEGER); }
+  bool visit_float32(float /*v*/) { return expect(msgpack::type::FLOAT32); }
+  bool visit_float64(double /*v*/) { return expect(msgpack::type::FLOAT64); }
+  bool visit_str(const char* /*v*/, uint32_t size) // NOLINT(build/unsigned)
+  {
+    return expect(msgpack::type::STR) && (size <= m_limit.str() || fail(kLimitExceeded));
+  }
+  bool visit_bin(const char* /*v*/, uint32_t size) // NOLINT(build/unsigned)
+  {
+    return expect(msgpack::type::BIN) && (size <= m_limit.bin() || fail(kLimitExceeded));
+  }
+  bool visit_ext(const char* /*v*/, uint32_t size) // NOLINT(build/unsigned)
+  {
+    return expect(msgpack::type::EXT) && (size <= m_limit.ext() || fail(kLimitExceeded));
+  }
+  bool start_array(uint32_t num_elements) // NOLINT(build/unsigned)
+  {
+    if (!expect(msgpack::type::ARRAY))
+      return false;
+    if (m_depth == 0 && m_shape && m_shape->fixed_size && num_elements != m_shape->fields.size())
+      return fail(kTypeMismatch);
+    return (num_elements <= m_limit.array() && enter()) || fail(kLimitExceeded);
+  }
+  bool end_array()
+  {
+    --m_depth;
+    return true;
+  }
+  bool start_map(uint32_t num_kv_pairs) // NOLINT(build/unsigned)
+  {
+    return expect(msgpack::type::MAP) && ((num_kv_pairs <= m_limit.map() && enter()) || fail(kLimitExceeded));
+  }
+  bool end_map()
+  {
+    --m_depth;
+    return true;
+  }
+  void parse_error(std::size_t /*parsed_offset*/, std::size_t /*error_offset*/) { m_error = kMalformed; }
+  void insufficient_bytes(std::size_t /*parsed_offset*/, std::size_t /*error_offset*/) { m_error = kTruncated; }
+
+private:
+  bool fail(DeserializationError err)
+  {
+    m_error = err;
+    return false;
+  }
+
+  // Check the type of an object that starts here, if it is the
+  // top-level object or a field of a top-level record
+  bool expect(msgpack::type::object_type type)
+  {
+    uint32_t bit = msgpack_type_bit(type); // NOLINT(build/unsigned)
+    // A reference to an interned string stands for a STR
+    if (m_interned && type == msgpack::type::EXT)
+      bit |= msgpack_type_bit(msgpack::type::STR);
+    if (m_depth == 0)
+      return (m_top_types & bit) || fail(kTypeMismatch);
+    if (m_depth == 1 && m_shape) {
+      std::size_t field = m_field++;
+      if (field < m_shape->fields.size() && !(m_shape->fields[field] & bit))
+        return fail(kTypeMismatch);
+    }
+    return true;
+  }
+
+  // The same depth check as msgpack::unpack(), which counts the
+  // top-level object as one level
+  bool enter()
+  {
+    if (m_depth + 1 > m_limit.depth())
+      return false;
+    ++m_depth;
+    return true;
+  }
+
+  msgpack::unpack_limit m_limit;
+  uint32_t m_top_types; // NOLINT(build/unsigned)
+  const RecordShape* m_shape;
+  bool m_interned;
+  std::size_t m_depth = 0;
+  std::size_t m_field = 0;
+  DeserializationError m_error = kMalformed;
+};
+
+template<class T>
+DeserializationResult<T>
+try_deserialize_impl(const uint8_t* msg, std::size_t msg_size, const DeserializationOptions& options); // NOLINT
+
+template<class T, class Codec>
+DeserializationResult<T>
+try_decompress_and_deserialize(const uint8_t* msg, // NOLINT(build/unsigned)
+                               std::size_t msg_size,
+                               const DeserializationOptions& options)
+{
+  if (!Codec::available)
+    return kCompressionError;
+  if (msg_size <= compression_header_size)
+    return kTruncated;
+  const uint8_t* src = msg + compression_header_size; // NOLINT(build/unsigned)
+  const std::size_t src_size = msg_size - compression_header_size;
+  const uint64_t inner_size = read_le64(msg + 1); // NOLINT(build/unsigned)
+  if (inner_size > options.max_decompressed_size)
+    return kLimitExceeded;
+  if (inner_size == 0 || !Codec::plausible(src, src_size, inner_size))
+    return kCompressionError;
+  std::shared_ptr<uint8_t[]> inner = allocate_decompressed(inner_size); // NOLINT(build/unsigned)
+  if (!inner)
+    return kLimitExceeded;
+  if (!Codec::decompress(src, src_size, inner.get(), inner_size))
+    return kCompressionError;
+  if (!valid_decompressed_message(inner.get()))
+    return kMalformed;
+  InputOwnerGuard guard(inner);
+  return try_deserialize_impl<T>(inner.get(), inner_size, options);
+}
+
+template<class T>
+DeserializationResult<T>
+try_deserialize_impl(const uint8_t* msg, std::size_t msg_size, const DeserializationOptions& options) // NOLINT
+{
+  using json = nlohmann::json;
+
+  if (msg_size == 0)
+    return kTruncated;
+
+  const char* data = reinterpret_cast<const char*>(msg + 1); // NOLINT
+  const std::size_t size = msg_size - 1;
+
+  switch (msg[0]) {
+    case serialization_type_byte(kJSON): {
+      json j = json::parse(data, data + size, nullptr, false);
+      if (j.is_discarded())
+        return kMalformed;
+      try {
+        return j.get<T>();
+      } catch (json::exception&) {
+        return kTypeMismatch;
+      }
+    }
+    case serialization_type_byte(kMsgPack):
+    case serialization_type_byte(kMsgPackInterned): {
+      // Check the message with a scan that allocates nothing, so that a
+      // broken one, or one holding a different type, is reported
+      // without msgpack throwing. Then unpack it exactly as
+      // deserialize() does
+      MessageValidator validator(options.unpack_limit,
+                                 accepted_msgpack_types<T>(),
+                                 record_shape<T>(),
+                                 msg[0] == serialization_type_byte(kMsgPackInterned));
+      std::size_t off = 0;
+      if (!msgpack::v2::parse(data, size, off, validator))
+        return validator.error();
+      if (options.reject_trailing_bytes && off != size)
+        return kSizeMismatch;
+      msgpack::object_handle oh;
+      msgpack::object obj;
+      try {
+        obj = unpack_msgpack(data, size, options, oh);
+      } catch (msgpack::unpack_error&) {
+        return kMalformed;
+      }
+      if (msg[0] == serialization_type_byte(kMsgPackInterned)) {
+        InternTable table(SIZE_MAX, false);
+        if (!table.resolve(obj))
+          return kMalformed;
+      }
+      try {
+        return obj.as<T>();
+      } catch (msgpack::type_error&) {
+        return kTypeMismatch;
+      }
+    }
+    case checksum_type_byte: {
+      if (msg_size <= checksum_header_size)
+        return kTruncated;
+      if (msg[checksum_header_size] == checksum_type_byte)
+        return kMalformed;
+      if (options.verify_checksum &&
+          read_le32(msg + 1) != crc32c(msg + checksum_header_size, msg_size - checksum_header_size))
+        return kChecksumMismatch;
+      return try_deserialize_impl<T>(msg + checksum_header_size, msg_size - checksum_header_size, options);
+    }
+    case lz4_type_byte:
+      return try_decompress_and_deserialize<T, Lz4Codec>(msg, msg_size, options);
+    case zstd_type_byte:
+      return try_decompress_and_deserialize<T, ZstdCodec>(msg, msg_size, options);
     default:
-      throw UnknownSerializationTypeByte(ERS_HERE, (char)v[0]); // NOLINT
+      return kBadFormatByte;
   }
 }
 
+} // namespace detail
+
+/**
+ * @brief Deserialize vector of bytes @p v into an instance of class
+ * @p T, returning an error code rather than throwing if it can't be
+ * done
+ *
+ * A MsgPack message is first checked by a scan that allocates nothing,
+ * so a broken message is detected without any exception being thrown.
+ * The scan also compares the top-level object, and the fields of a
+ * record, with the types that @p T can be converted from, so a message
+ * holding a different type is usually rejected without an exception
+ * too. Mismatches deeper in the message, and in JSON messages, are
+ * reported by msgpack and nlohmann::json with a type_error or
+ * json::exception, which is caught here and returned as kTypeMismatch,
+ * without creating an ERS issue. Any other exception thrown while converting the
+ * message, eg by a type's own from_json() or msgpack convert, is not
+ * caught, and propagates out of try_deserialize().
+ */
+template<class T, typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+DeserializationResult<T>
+try_deserialize(const std::vector<CharType, Alloc>& v, const DeserializationOptions& options = DeserializationOptions())
+{
+  detail::InputOwnerGuard guard(nullptr);
+  return detail::try_deserialize_impl<T>(reinterpret_cast<const uint8_t*>(v.data()), v.size(), options); // NOLINT
+}
+
 } // namespace serialization
 } // namespace dunedaq
 
@@ -0,0 +1,180 @@
+/**
+ * @file StringInterning.hpp
+ *
+ * Streaming string interning: a persistent dictionary shared by all
+ * the messages on a stream, so that a string sent once is afterwards
+ * sent as a small integer id. For single messages with an embedded
+ * (implicit) dictionary, use the kMsgPackInterned serialization type
+ * instead
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_STRINGINTERNING_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_STRINGINTERNING_HPP_
+
+#include "serialization/Serialization.hpp"
+#include "serialization/detail/StringTable.hpp"
+
+#include "ers/Issue.hpp"
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+
+// clang-format off
+// Disable coverage collection LCOV_EXCL_START
+ERS_DECLARE_ISSUE(serialization,                                                  // namespace
+                  InternDictionaryMismatch,                                       // issue name
+                  "String dictionary out of sync: decoder has " << decoder_size
+                  << " entries but the frame expects " << encoder_size,           // message
+                  ((uint64_t)decoder_size)((uint64_t)encoder_size))               // attributes // NOLINT
+
+// clang-format on
+// Re-enable coverage collection LCOV_EXCL_STOP
+
+namespace serialization {
+
+/**
+ * @brief First byte of every frame produced by a StringInternEncoder
+ */
+constexpr uint8_t interned_stream_frame_byte = 'S'; // NOLINT(build/unsigned)
+
+/**
+ * @brief Serializes a stream of objects to MsgPack, keeping a
+ * dictionary of the strings sent so far
+ *
+ * The first occurrence of each string (of at least three characters)
+ * defines an id, and later occurrences, in the same or any later
+ * message, are sent as that id. Objects of different types can share
+ * one stream. Frames must be decoded, by a single StringInternDecoder,
+ * in the order they were encoded and without gaps. Each frame carries
+ * the size of the dictionary it was encoded against, so a decoder
+ * that has lost sync throws InternDictionaryMismatch instead of
+ * producing wrong strings; both ends must then be reset().
+ *
+ * Once @p max_entries ids have been assigned, new strings are sent in
+ * full. The encoder and decoder must use the same value.
+ *
+ * MsgPack EXT type 0x7e is reserved for string references: encoding an
+ * object containing one throws ReservedExtType, and leaves the
+ * dictionary unchanged.
+ */
+class StringInternEncoder
+{
+public:
+  explicit StringInternEncoder(std::size_t max_entries = 4096)
+    : m_dict(max_entries, true)
+  {}
+
+  template<class T>
+  std::vector<uint8_t> encode(const T& obj) // NOLINT(build/unsigned)
+  {
+    m_buf.clear();
+    msgpack::pack(m_buf, obj);
+    msgpack::object_handle oh =
+      msgpack::unpack(m_buf.data(), m_buf.size(), [](msgpack::type::object_type, std::size_t, void*) -> bool { return true; });
+
+    std::vector<uint8_t> ret; // NOLINT(build/unsigned)
+    ret.reserve(m_buf.size() + 10);
+    ret.push_back(interned_stream_frame_byte);
+    detail::VectorWriter<std::vector<uint8_t>> writer{ ret };              // NOLINT(build/unsigned)
+    msgpack::packer<detail::VectorWriter<std::vector<uint8_t>>> pk(writer); // NOLINT(build/unsigned)
+    pk.pack(static_cast<uint64_t>(m_dict.size()));                          // NOLINT(build/unsigned)
+    m_dict.pack(pk, oh.get());
+    return ret;
+  }
+
+  /**
+   * @brief Number of strings in the dictionary
+   */
+  std::size_t dictionary_size() const { return m_dict.size(); }
+
+  /**
+   * @brief Forget all strings, eg when the receiver reconnects
+   */
+  void reset() { m_dict.clear(); }
+
+private:
+  detail::InternDictionary m_dict;
+  msgpack::sbuffer m_buf;
+};
+
+/**
+ * @brief Decodes frames produced by a StringInternEncoder
+ *
+ * Strings are copied into the decoded object, those referenced by id
+ * from the decoder's table and the rest from the frame. A
+ * std::string_view member would view one or the other, so it must not
+ * outlive the frame
+ */
+class StringInternDecoder
+{
+public:
+  explicit StringInternDecoder(std::size_t max_entries = 4096)
+    : m_table(max_entries, true)
+  {}
+
+  template<class T, typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+  T decode(const std::vector<CharType, Alloc>& frame)
+  {
+    if (frame.empty())
+      throw CannotDeserializeMessage(ERS_HERE);
+    if (static_cast<uint8_t>(frame[0]) != interned_stream_frame_byte) // NOLINT(build/unsigned)
+      throw UnknownSerializationTypeByte(ERS_HERE, (char)frame[0]);  // NOLINT
+
+    const char* data = reinterpret_cast<const char*>(frame.data()); // NOLINT
+    const std::size_t size = frame.size();
+    try {
+      std::size_t off = 1;
+      uint64_t expected_size = msgpack::unpack(data, size, off).get().as<uint64_t>(); // NOLINT(build/unsigned)
+      if (expected_size != m_table.size())
+        throw InternDictionaryMismatch(ERS_HERE, m_table.size(), expected_size);
+
+      msgpack::object_handle oh = msgpack::unpack(
+        data + off, size - off, [](msgpack::type::object_type, std::size_t, void*) -> bool { return true; });
+      msgpack::object obj = oh.get();
+      // Strings from a frame with an invalid reference are dropped
+      // again, so that the dictionary only ever holds entries from
+      // whole frames, and the next frame's size check detects the loss.
+      // Once resolved, the table matches the encoder's, so it is kept
+      // even if the frame then holds the wrong type
+      const std::size_t committed_size = m_table.size();
+      if (!m_table.resolve(obj)) {
+        m_table.truncate(committed_size);
+        throw CannotDeserializeMessage(ERS_HERE);
+      }
+      // The caller may free the frame as soon as decode() returns
+      detail::InputOwnerGuard no_borrow(nullptr, false);
+      return obj.as<T>();
+    } catch (msgpack::type_error& e) {
+      throw CannotDeserializeMessage(ERS_HERE, e);
+    } catch (msgpack::unpack_error& e) {
+      throw CannotDeserializeMessage(ERS_HERE, e);
+    }
+  }
+
+  /**
+   * @brief Number of strings in the dictionary
+   */
+  std::size_t dictionary_size() const { return m_table.size(); }
+
+  /**
+   * @brief Forget all strings. The encoder must be reset() at the same point in the stream
+   */
+  void reset() { m_table.clear(); }
+
+private:
+  detail::InternTable m_table;
+};
+
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_STRINGINTERNING_HPP_
@@ -0,0 +1,1098 @@
+/**
+ * @file Transcoder.hpp
+ *
+ * Conversion of MsgPack messages to JSON messages and back, without
+ * the C++ type of the message. Each direction is a single pass over
+ * the input, with no intermediate msgpack::object tree or
+ * nlohmann::json DOM, for tools like monitoring taps and debug
+ * dumpers that don't link every message type
+ *
+ * MsgPack stores a record (a class made serializable with
+ * DUNE_DAQ_SERIALIZE) as an array of its fields, without their names,
+ * and JSON as an object. To produce the same JSON as serialize(kJSON)
+ * would, the transcoder needs the field names, which come from an
+ * optional FieldRegistry. Without one, records are transcoded as
+ * arrays. The registry also knows which fields are maps, since JSON
+ * writes a map whose keys aren't strings as an array of [key, value]
+ * pairs
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_TRANSCODER_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_TRANSCODER_HPP_
+
+#include "serialization/Serialization.hpp"
+
+#include "ers/Issue.hpp"
+#include "msgpack.hpp"
+#include "nlohmann/json.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+
+// clang-format off
+// Disable coverage collection LCOV_EXCL_START
+ERS_DECLARE_ISSUE(serialization,                                                  // namespace
+                  CannotTranscodeMessage,                                         // issue name
+                  "Cannot transcode message: " << reason,                         // message
+                  ((std::string)reason))                                          // attributes
+
+// clang-format on
+// Re-enable coverage collection LCOV_EXCL_STOP
+
+namespace serialization {
+
+/**
+ * @brief How a record field is represented, where that differs between
+ * MsgPack and JSON
+ */
+enum FieldKind
+{
+  kValue,          ///< Same structure in both formats
+  kRecord,         ///< A record: MsgPack array, JSON object
+  kRecordSequence, ///< A sequence of records
+  kBinary,         ///< Bytes: MsgPack BIN, JSON array of numbers
+  kMap             ///< A map: MsgPack map, JSON object or array of [key, value] pairs
+};
+
+/**
+ * @brief How a record field is transcoded. A std::optional field is
+ * described by its value type. Records nested any deeper than listed
+ * here, eg in a map of sequences of records, are transcoded as arrays
+ */
+struct FieldInfo
+{
+  std::string name;
+  FieldKind kind = kValue;
+  /// For kRecord and kRecordSequence, the registry key of the record
+  /// type. For kMap, that of the value type, if it is a record
+  std::string record;
+  /// For kMap, whether JSON writes the map as an object. Otherwise it
+  /// is an array of [key, value] pairs
+  bool string_keys = true;
+};
+
+/**
+ * @brief Field names of record types, keyed by typestring
+ *
+ * Types made serializable with DUNE_DAQ_SERIALIZE or
+ * DUNE_DAQ_SERIALIZE_NON_INTRUSIVE are added with add<T>(), which
+ * also adds the record types of their fields. Records without a
+ * typestring (see DUNE_DAQ_TYPESTRING) are keyed by their
+ * implementation-defined type name instead. Other types, such as
+ * moo-generated ones, are added by listing their fields
+ */
+class FieldRegistry
+{
+public:
+  void add(const std::string& typestring, std::vector<FieldInfo> fields)
+  {
+    m_records[typestring] = std::move(fields);
+  }
+
+  template<class T>
+  void add()
+  {
+    add_record<T>();
+  }
+
+  /**
+   * @brief The fields of record type @p typestring, or nullptr if it
+   * isn't known
+   */
+  const std::vector<FieldInfo>* find(const std::string& typestring) const
+  {
+    auto it = m_records.find(typestring);
+    return it == m_records.end() ? nullptr : &it->second;
+  }
+
+  /**
+   * @brief Registry key of record type @p T
+   */
+  template<class T>
+  static std::string key()
+  {
+    std::string typestring = datatype_to_string<T>();
+    return typestring != "Unknown" ? typestring : typeid(T).name();
+  }
+
+  std::size_t size() const { return m_records.size(); }
+
+private:
+  struct Collector
+  {
+    FieldRegistry& registry;
+    std::vector<FieldInfo> fields;
+
+    template<class U>
+    void field(const char* name)
+    {
+      fields.push_back(registry.field_info<U>(name));
+    }
+  };
+
+  template<class T>
+  std::string add_record()
+  {
+    static_assert(record_fields<T>::value, "T must be made serializable with DUNE_DAQ_SERIALIZE");
+    std::string k = key<T>();
+    if (m_records.count(k))
+      return k;
+    // Insert the key first, so that a type containing a sequence of
+    // itself doesn't recurse forever
+    m_records[k];
+    Collector collector{ *this, {} };
+    record_fields<T>::visit(collector);
+    m_records[k] = std::move(collector.fields);
+    return k;
+  }
+
+  template<class U>
+  FieldInfo field_info(const char* name)
+  {
+    FieldInfo info{ name, kValue, "", true };
+    if constexpr (detail::is_optional<U>::value) {
+      // An empty optional is nil in MsgPack and null in JSON, which need no schema
+      info = field_info<typename U::value_type>(name);
+    } else if constexpr (record_fields<U>::value) {
+      info.kind = kRecord;
+      info.record = add_record<U>();
+    } else if constexpr (detail::is_binary<U>::value) {
+      info.kind = kBinary;
+    } else if constexpr (detail::is_vector<U>::value) {
+      if constexpr (record_fields<typename U::value_type>::value) {
+        info.kind = kRecordSequence;
+        info.record = add_record<typename U::value_type>();
+      }
+    } else if constexpr (detail::is_map<U>::value) {
+      info.kind = kMap;
+      // The test nlohmann::json uses to write a map as an object
+      info.string_keys = std::is_constructible_v<std::string, typename U::key_type>;
+      if constexpr (record_fields<typename U::mapped_type>::value)
+        info.record = add_record<typename U::mapped_type>();
+    }
+    return info;
+  }
+
+  std::unordered_map<std::string, std::vector<FieldInfo>> m_records;
+};
+
+namespace detail {
+
+inline void
+append(std::vector<uint8_t>& out, std::string_view s) // NOLINT(build/unsigned)
+{
+  out.insert(out.end(), s.begin(), s.end());
+}
+
+template<typename Int>
+void
+write_json_integer(std::vector<uint8_t>& out, Int v) // NOLINT(build/unsigned)
+{
+  char buf[24];
+  auto res = std::to_chars(buf, buf + sizeof(buf), v);
+  out.insert(out.end(), buf, res.ptr);
+}
+
+inline void
+write_json_float(std::vector<uint8_t>& out, double v) // NOLINT(build/unsigned)
+{
+  // As nlohmann::json does: non-finite values become null, and
+  // integral values get a ".0", so that they read back as floating point
+  if (!std::isfinite(v)) {
+    append(out, "null");
+    return;
+  }
+  char buf[32];
+  auto res = std::to_chars(buf, buf + sizeof(buf), v);
+  out.insert(out.end(), buf, res.ptr);
+  if (std::find_if(buf, res.ptr, [](char c) { return c == '.' || c == 'e'; }) == res.ptr)
+    append(out, ".0");
+}
+
+/**
+ * @brief Length of the valid UTF-8 sequence at @p p, or 0 if it isn't one
+ */
+inline std::size_t
+utf8_sequence_length(const uint8_t* p, std::size_t size) // NOLINT(build/unsigned)
+{
+  uint8_t b = p[0]; // NOLINT(build/unsigned)
+  std::size_t n;
+  uint8_t lo = 0x80, hi = 0xbf; // Range of the second byte // NOLINT(build/unsigned)
+  if (b >= 0xc2 && b <= 0xdf) {
+    n = 2;
+  } else if (b >= 0xe0 && b <= 0xef) {
+    n = 3;
+    lo = b == 0xe0 ? 0xa0 : 0x80; // No overlong encodings
+    hi = b == 0xed ? 0x9f : 0xbf; // No surrogates
+  } else if (b >= 0xf0 && b <= 0xf4) {
+    n = 4;
+    lo = b == 0xf0 ? 0x90 : 0x80;
+    hi = b == 0xf4 ? 0x8f : 0xbf; // Nothing above U+10FFFF
+  } else {
+    return 0;
+  }
+  if (size < n || p[1] < lo || p[1] > hi)
+    return 0;
+  for (std::size_t i = 2; i < n; ++i)
+    if ((p[i] & 0xc0) != 0x80)
+      return 0;
+  return n;
+}
+
+/**
+ * @brief Write @p size bytes at @p s as a JSON string, escaped as
+ * nlohmann::json does. Invalid UTF-8 is replaced by U+FFFD
+ */
+inline void
+write_json_string(std::vector<uint8_t>& out, const char* s, std::size_t size) // NOLINT(build/unsigned)
+{
+  static constexpr char hex[] = "0123456789abcdef";
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(s); // NOLINT
+  const uint8_t* end = p + size;                          // NOLINT(build/unsigned)
+  out.push_back('"');
+  while (p < end) {
+    // Copy runs of characters that need no escaping in one go
+    const uint8_t* run = p; // NOLINT(build/unsigned)
+    while (p < end && *p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\')
+      ++p;
+    out.insert(out.end(), run, p);
+    if (p == end)
+      break;
+    uint8_t c = *p; // NOLINT(build/unsigned)
+    if (c >= 0x80) {
+      std::size_t n = utf8_sequence_length(p, end - p);
+      if (n == 0) {
+        append(out, "\xef\xbf\xbd");
+        ++p;
+      } else {
+        out.insert(out.end(), p, p + n);
+        p += n;
+      }
+      continue;
+    }
+    out.push_back('\\');
+    switch (c) {
+      case '"':
+      case '\\':
+        out.push_back(c);
+        break;
+      case '\b':
+        out.push_back('b');
+        break;
+      case '\f':
+        out.push_back('f');
+        break;
+      case '\n':
+        out.push_back('n');
+        break;
+      case '\r':
+        out.push_back('r');
+        break;
+      case '\t':
+        out.push_back('t');
+        break;
+      default:
+        append(out, "u00");
+        out.push_back(hex[c >> 4]);
+        out.push_back(hex[c & 0xf]);
+    }
+    ++p;
+  }
+  out.push_back('"');
+}
+
+inline void
+write_be32(uint8_t* p, uint32_t v) // NOLINT(build/unsigned)
+{
+  for (int i = 0; i < 4; ++i)
+    p[i] = static_cast<uint8_t>(v >> (8 * (3 - i))); // NOLINT(build/unsigned)
+}
+
+/**
+ * @brief msgpack::v2::parse visitor that writes the JSON equivalent of
+ * the MsgPack it visits
+ */
+class JsonWriterVisitor : public msgpack::null_visitor
+{
+public:
+  JsonWriterVisitor(std::vector<uint8_t>& out, // NOLINT(build/unsigned)
+                    const FieldRegistry* registry,
+                    const std::vector<FieldInfo>* root,
+                    bool interned)
+    : m_out(out)
+    , m_registry(registry)
+    , m_next_kind(root ? kRecord : kValue)
+    , m_next(root)
+    , m_interned(interned)
+  {}
+
+  bool visit_nil()
+  {
+    if (!begin_value(false))
+      return false;
+    append(m_out, "null");
+    return true;
+  }
+  bool visit_boolean(bool v)
+  {
+    if (!begin_value(false))
+      return false;
+    append(m_out, v ? "true" : "false");
+    return true;
+  }
+  bool visit_positive_integer(uint64_t v) // NOLINT(build/unsigned)
+  {
+    if (!begin_value(false))
+      return false;
+    write_json_integer(m_out, v);
+    return true;
+  }
+  bool visit_negative_integer(int64_t v)
+  {
+    if (!begin_value(false))
+      return false;
+    write_json_integer(m_out, v);
+    return true;
+  }
+  bool visit_float32(float v) { return visit_float64(v); }
+  bool visit_float64(double v)
+  {
+    if (!begin_value(false))
+      return false;
+    write_json_float(m_out, v);
+    return true;
+  }
+  bool visit_str(const char* v, uint32_t size) // NOLINT(build/unsigned)
+  {
+    if (!begin_value(true))
+      return false;
+    // Same numbering as InternTable::resolve()
+    if (m_interned && size >= intern_min_length)
+      m_strings.emplace_back(v, size);
+    write_json_string(m_out, v, size);
+    return true;
+  }
+  bool visit_bin(const char* v, uint32_t size) // NOLINT(build/unsigned)
+  {
+    if (!begin_value(false))
+      return false;
+    write_bytes(v, size);
+    return true;
+  }
+  bool visit_ext(const char* v, uint32_t size) // NOLINT(build/unsigned)
+  {
+    // v[0] is the EXT type
+    if (m_interned && static_cast<int8_t>(v[0]) == intern_ref_ext_type) {
+      uint32_t n = size - 1; // NOLINT(build/unsigned)
+      if (n != 1 && n != 2 && n != 4)
+        return fail("invalid interned string reference");
+      uint32_t id = 0;                 // NOLINT(build/unsigned)
+      for (uint32_t i = 1; i <= n; ++i) // NOLINT(build/unsigned)
+        id = (id << 8) | static_cast<uint8_t>(v[i]); // NOLINT(build/unsigned)
+      if (id >= m_strings.size())
+        return fail("invalid interned string reference");
+      if (!begin_value(true))
+        return false;
+      write_json_string(m_out, m_strings[id].data(), m_strings[id].size());
+      return true;
+    }
+    // As nlohmann::json writes binary values with a subtype
+    if (!begin_value(false))
+      return false;
+    append(m_out, "{\"bytes\":");
+    write_bytes(v + 1, size - 1);
+    append(m_out, ",\"subtype\":");
+    write_json_integer(m_out, static_cast<int>(static_cast<uint8_t>(v[0]))); // NOLINT(build/unsigned)
+    m_out.push_back('}');
+    return true;
+  }
+
+  bool start_array(uint32_t size) // NOLINT(build/unsigned)
+  {
+    const FieldKind kind = m_next_kind;
+    const std::vector<FieldInfo>* schema = m_next;
+    if (!begin_value(false))
+      return false;
+    if (kind == kRecord && schema && schema->size() == size) {
+      m_stack.push_back(Frame{ Frame::kRecord, m_out.size(), schema, 0 });
+      m_out.push_back('{');
+    } else {
+      m_stack.push_back(Frame{ Frame::kArray, m_out.size(), kind == kRecordSequence ? schema : nullptr, 0 });
+      m_out.push_back('[');
+    }
+    return true;
+  }
+  bool start_array_item()
+  {
+    Frame& frame = m_stack.back();
+    if (frame.index > 0)
+      m_out.push_back(',');
+    if (frame.kind == Frame::kRecord) {
+      const FieldInfo& field = (*frame.fields)[frame.index];
+      write_json_string(m_out, field.name.data(), field.name.size());
+      m_out.push_back(':');
+      m_next_kind = field.kind;
+      m_next = field.record.empty() ? nullptr : lookup(field.record);
+      m_next_string_keys = field.string_keys;
+    } else {
+      set_next_record(frame.fields);
+    }
+    return true;
+  }
+  bool end_array_item()
+  {
+    ++m_stack.back().index;
+    return true;
+  }
+  bool end_array()
+  {
+    m_out.push_back(m_stack.back().kind == Frame::kRecord ? '}' : ']');
+    m_stack.pop_back();
+    return true;
+  }
+
+  bool start_map(uint32_t /*size*/) // NOLINT(build/unsigned)
+  {
+    const bool known_map = m_next_kind == kMap;
+    const std::vector<FieldInfo>* values = known_map ? m_next : nullptr;
+    // Without a schema, the first key decides how the map is written
+    // (see begin_value()), which can't work for an empty map
+    const bool pairs = known_map && !m_next_string_keys;
+    if (!begin_value(false))
+      return false;
+    m_stack.push_back(Frame{ pairs ? Frame::kPairs : Frame::kMap, m_out.size(), values, 0 });
+    m_out.push_back(pairs ? '[' : '{');
+    return true;
+  }
+  bool start_map_key()
+  {
+    Frame& frame = m_stack.back();
+    if (frame.index > 0)
+      m_out.push_back(',');
+    if (frame.kind == Frame::kPairs)
+      m_out.push_back('[');
+    m_in_key = true;
+    set_next_record(nullptr);
+    return true;
+  }
+  bool end_map_key()
+  {
+    m_out.push_back(m_stack.back().kind == Frame::kMap ? ':' : ',');
+    return true;
+  }
+  bool start_map_value()
+  {
+    set_next_record(m_stack.back().fields);
+    return true;
+  }
+  bool end_map_value()
+  {
+    Frame& frame = m_stack.back();
+    if (frame.kind == Frame::kPairs)
+      m_out.push_back(']');
+    ++frame.index;
+    return true;
+  }
+  bool end_map()
+  {
+    m_out.push_back(m_stack.back().kind == Frame::kMap ? '}' : ']');
+    m_stack.pop_back();
+    return true;
+  }
+
+  void parse_error(std::size_t /*parsed_offset*/, std::size_t /*error_offset*/) { m_error = "malformed MsgPack"; }
+  void insufficient_bytes(std::size_t /*parsed_offset*/, std::size_t /*error_offset*/)
+  {
+    m_error = "truncated MsgPack";
+  }
+
+  const std::string& error() const { return m_error; }
+
+private:
+  struct Frame
+  {
+    enum Kind
+    {
+      kArray,
+      kRecord,
+      kMap,
+      kPairs ///< A map whose keys aren't strings, written as an array of [key, value] pairs, as nlohmann::json does
+    } kind;
+    std::size_t open_pos; // Offset of the opening bracket in the output
+    // kRecord: the fields. Otherwise: the fields of the items or map values, if they are records
+    const std::vector<FieldInfo>* fields;
+    uint32_t index;                       // NOLINT(build/unsigned)
+  };
+
+  // Called at the start of every value. Decides how to write a map
+  // from the type of its first key
+  bool begin_value(bool is_string)
+  {
+    if (!m_in_key)
+      return true;
+    m_in_key = false;
+    Frame& frame = m_stack.back();
+    if (frame.kind == Frame::kMap && !is_string) {
+      if (frame.index > 0)
+        return fail("map has keys of mixed types");
+      frame.kind = Frame::kPairs;
+      m_out[frame.open_pos] = '[';
+      m_out.push_back('[');
+    }
+    return true;
+  }
+
+  void write_bytes(const char* v, uint32_t size) // NOLINT(build/unsigned)
+  {
+    m_out.push_back('[');
+    for (uint32_t i = 0; i < size; ++i) { // NOLINT(build/unsigned)
+      if (i > 0)
+        m_out.push_back(',');
+      write_json_integer(m_out, static_cast<unsigned>(static_cast<uint8_t>(v[i]))); // NOLINT(build/unsigned)
+    }
+    m_out.push_back(']');
+  }
+
+  const std::vector<FieldInfo>* lookup(const std::string& record) const
+  {
+    return m_registry ? m_registry->find(record) : nullptr;
+  }
+
+  // The next value is a record with @p fields, or has no schema if null
+  void set_next_record(const std::vector<FieldInfo>* fields)
+  {
+    m_next_kind = fields ? kRecord : kValue;
+    m_next = fields;
+  }
+
+  bool fail(const char* reason)
+  {
+    m_error = reason;
+    return false;
+  }
+
+  std::vector<uint8_t>& m_out; // NOLINT(build/unsigned)
+  const FieldRegistry* m_registry;
+  FieldKind m_next_kind;                // Representation of the next value
+  const std::vector<FieldInfo>* m_next; // Record type of the next value, its items or its map values
+  bool m_next_string_keys = true;       // For a kMap value, whether JSON writes it as an object
+  bool m_interned;
+  bool m_in_key = false;
+  std::vector<Frame> m_stack;
+  std::vector<std::string_view> m_strings; // Interned strings, in id order
+  std::string m_error;
+};
+
+/**
+ * @brief nlohmann::json SAX handler that writes the MsgPack equivalent
+ * of the JSON it is given
+ *
+ * Arrays and maps are written with a 32-bit count that is filled in
+ * when they end. Record fields may appear in any order in JSON, so
+ * each field is packed into its own buffer, and they are put in order
+ * when the record ends. A map field written as an array of [key,
+ * value] pairs is written as a MsgPack map
+ */
+class MsgPackWriterSax
+{
+public:
+  using json = nlohmann::json;
+
+  MsgPackWriterSax(std::vector<uint8_t>& out, // NOLINT(build/unsigned)
+                   const FieldRegistry* registry,
+                   const std::vector<FieldInfo>* root)
+    : m_result(out)
+    , m_out(&out)
+    , m_registry(registry)
+    , m_next_kind(root ? kRecord : kValue)
+    , m_next(root)
+  {}
+
+  bool null()
+  {
+    if (!begin_value())
+      return false;
+    m_out->push_back(0xc0);
+    return true;
+  }
+  bool boolean(bool v)
+  {
+    if (!begin_value())
+      return false;
+    m_out->push_back(v ? 0xc3 : 0xc2);
+    return true;
+  }
+  bool number_integer(json::number_integer_t v)
+  {
+    if (in_binary())
+      return add_byte(v);
+    if (!begin_value())
+      return false;
+    pack(v);
+    return true;
+  }
+  bool number_unsigned(json::number_unsigned_t v)
+  {
+    if (in_binary())
+      return add_byte(v);
+    if (!begin_value())
+      return false;
+    pack(v);
+    return true;
+  }
+  bool number_float(json::number_float_t v, const json::string_t& /*s*/)
+  {
+    if (!begin_value())
+      return false;
+    pack(v);
+    return true;
+  }
+  bool string(json::string_t& v)
+  {
+    if (!begin_value())
+      return false;
+    pack_string(*m_out, v);
+    return true;
+  }
+  bool binary(json::binary_t& v)
+  {
+    if (!begin_value())
+      return false;
+    VectorWriter<std::vector<uint8_t>> writer{ *m_out };            // NOLINT(build/unsigned)
+    msgpack::packer<VectorWriter<std::vector<uint8_t>>> pk(writer); // NOLINT(build/unsigned)
+    pk.pack_bin(static_cast<uint32_t>(v.size()));                                          // NOLINT(build/unsigned)
+    pk.pack_bin_body(reinterpret_cast<const char*>(v.data()), static_cast<uint32_t>(v.size())); // NOLINT
+    return true;
+  }
+
+  bool start_object(std::size_t /*size*/)
+  {
+    if (!begin_value())
+      return false;
+    if (m_next_kind == kRecord && m_next) {
+      Frame frame{ Frame::kRecord, m_out, 0, 0, m_next, {}, {}, nullptr };
+      frame.slots.resize(m_next->size());
+      frame.filled.resize(m_next->size());
+      m_stack.push_back(std::move(frame));
+    } else {
+      const std::vector<FieldInfo>* values = m_next_kind == kMap ? m_next : nullptr;
+      m_stack.push_back(Frame{ Frame::kMap, m_out, begin_container(0xdf), 0, values, {}, {}, m_out });
+    }
+    return true;
+  }
+  bool key(json::string_t& k)
+  {
+    Frame& frame = m_stack.back();
+    if (frame.kind == Frame::kMap) {
+      ++frame.count;
+      pack_string(*frame.out, k);
+      set_next_record(frame.fields);
+      return true;
+    }
+    auto& fields = *frame.fields;
+    auto it = std::find_if(fields.begin(), fields.end(), [&k](const FieldInfo& f) { return f.name == k; });
+    if (it == fields.end()) {
+      // Unknown fields are dropped, as they would be by from_json()
+      m_discard.clear();
+      frame.cur = &m_discard;
+      m_next_kind = kValue;
+    } else {
+      std::size_t i = it - fields.begin();
+      frame.slots[i].clear();
+      frame.filled[i] = true;
+      frame.cur = &frame.slots[i];
+      m_next_kind = it->kind;
+      m_next = it->record.empty() ? nullptr : lookup(it->record);
+    }
+    m_out = frame.cur;
+    return true;
+  }
+  bool end_object()
+  {
+    Frame frame = std::move(m_stack.back());
+    m_stack.pop_back();
+    if (frame.kind == Frame::kRecord) {
+      for (std::size_t i = 0; i < frame.fields->size(); ++i) {
+        if (!frame.filled[i])
+          return fail("missing field \"" + (*frame.fields)[i].name + "\"");
+      }
+      VectorWriter<std::vector<uint8_t>> writer{ *frame.out }; // NOLINT(build/unsigned)
+      msgpack::packer<VectorWriter<std::vector<uint8_t>>>(writer).pack_array( // NOLINT(build/unsigned)
+        static_cast<uint32_t>(frame.slots.size()));                          // NOLINT(build/unsigned)
+      for (auto& slot : frame.slots)
+        frame.out->insert(frame.out->end(), slot.begin(), slot.end());
+    } else {
+      write_be32(frame.out->data() + frame.header_pos, frame.count);
+    }
+    end_container();
+    return true;
+  }
+
+  bool start_array(std::size_t /*size*/)
+  {
+    if (!m_stack.empty() && m_stack.back().kind == Frame::kPairs) {
+      // One [key, value] pair, whose key and value go straight into the map
+      Frame& pairs = m_stack.back();
+      ++pairs.count;
+      m_stack.push_back(Frame{ Frame::kPair, m_out, 0, 0, pairs.fields, {}, {}, m_out });
+      return true;
+    }
+    if (!begin_value())
+      return false;
+    if (m_next_kind == kBinary) {
+      m_stack.push_back(Frame{ Frame::kBinary, m_out, begin_container(0xc6), 0, nullptr, {}, {}, m_out });
+    } else if (m_next_kind == kMap) {
+      m_stack.push_back(Frame{ Frame::kPairs, m_out, begin_container(0xdf), 0, m_next, {}, {}, m_out });
+    } else {
+      const std::vector<FieldInfo>* items = m_next_kind == kRecordSequence ? m_next : nullptr;
+      m_stack.push_back(Frame{ Frame::kArray, m_out, begin_container(0xdd), 0, items, {}, {}, m_out });
+    }
+    return true;
+  }
+  bool end_array()
+  {
+    Frame& frame = m_stack.back();
+    if (frame.kind == Frame::kPair) {
+      if (frame.count != 2)
+        return fail("map entry isn't a [key, value] pair");
+    } else {
+      write_be32(frame.out->data() + frame.header_pos, frame.count);
+    }
+    m_stack.pop_back();
+    end_container();
+    return true;
+  }
+
+  bool parse_error(std::size_t /*position*/, const std::string& /*last_token*/, const nlohmann::detail::exception& e)
+  {
+    return fail(e.what());
+  }
+
+  const std::string& error() const { return m_error; }
+
+private:
+  struct Frame
+  {
+    enum Kind
+    {
+      kArray,
+      kMap,
+      kRecord,
+      kBinary,
+      kPairs, ///< A map written as an array of [key, value] pairs
+      kPair   ///< One of those pairs
+    } kind;
+    // Buffer that the container is written to
+    std::vector<uint8_t>* out; // NOLINT(build/unsigned)
+    // kArray, kMap, kBinary, kPairs: offset of the 32-bit count in out
+    std::size_t header_pos;
+    uint32_t count; // NOLINT(build/unsigned)
+    // kRecord: the fields. Otherwise: the fields of the items or map values, if they are records
+    const std::vector<FieldInfo>* fields;
+    // kRecord: the packed value of each field, and whether it has been seen
+    std::vector<std::vector<uint8_t>> slots; // NOLINT(build/unsigned)
+    std::vector<bool> filled;
+    // Buffer that values in the container are written to
+    std::vector<uint8_t>* cur; // NOLINT(build/unsigned)
+  };
+
+  template<typename V>
+  void pack(const V& v)
+  {
+    VectorWriter<std::vector<uint8_t>> writer{ *m_out }; // NOLINT(build/unsigned)
+    msgpack::pack(writer, v);
+  }
+
+  static void pack_string(std::vector<uint8_t>& out, const std::string& s) // NOLINT(build/unsigned)
+  {
+    VectorWriter<std::vector<uint8_t>> writer{ out }; // NOLINT(build/unsigned)
+    msgpack::packer<VectorWriter<std::vector<uint8_t>>> pk(writer); // NOLINT(build/unsigned)
+    pk.pack_str(static_cast<uint32_t>(s.size()));            // NOLINT(build/unsigned)
+    pk.pack_str_body(s.data(), static_cast<uint32_t>(s.size())); // NOLINT(build/unsigned)
+  }
+
+  // Write a container header with a placeholder 32-bit count, and
+  // return the offset of the count
+  std::size_t begin_container(uint8_t marker) // NOLINT(build/unsigned)
+  {
+    m_out->push_back(marker);
+    m_out->resize(m_out->size() + 4);
+    return m_out->size() - 4;
+  }
+
+  void end_container() { m_out = m_stack.empty() ? &m_result : m_stack.back().cur; }
+
+  // Called at the start of every value except bytes of a binary
+  // field. Sets the schema of the value
+  bool begin_value()
+  {
+    if (m_stack.empty())
+      return true;
+    Frame& frame = m_stack.back();
+    switch (frame.kind) {
+      case Frame::kArray:
+        ++frame.count;
+        set_next_record(frame.fields);
+        return true;
+      case Frame::kBinary:
+        return fail("binary field holds a value that isn't a byte");
+      case Frame::kPairs:
+        return fail("map entry isn't a [key, value] pair");
+      case Frame::kPair:
+        if (frame.count == 2)
+          return fail("map entry isn't a [key, value] pair");
+        // The key has no schema; the value may be a record
+        set_next_record(frame.count++ == 0 ? nullptr : frame.fields);
+        return true;
+      default:
+        // Maps and records: the schema was set by key()
+        return true;
+    }
+  }
+
+  bool in_binary() const { return !m_stack.empty() && m_stack.back().kind == Frame::kBinary; }
+
+  template<typename Int>
+  bool add_byte(Int v)
+  {
+    if (v < 0 || v > 0xff)
+      return fail("binary field holds a value that isn't a byte");
+    m_out->push_back(static_cast<uint8_t>(v)); // NOLINT(build/unsigned)
+    ++m_stack.back().count;
+    return true;
+  }
+
+  const std::vector<FieldInfo>* lookup(const std::string& record) const
+  {
+    return m_registry ? m_registry->find(record) : nullptr;
+  }
+
+  // The next value is a record with @p fields, or has no schema if null
+  void set_next_record(const std::vector<FieldInfo>* fields)
+  {
+    m_next_kind = fields ? kRecord : kValue;
+    m_next = fields;
+  }
+
+  bool fail(const std::string& reason)
+  {
+    m_error = reason;
+    return false;
+  }
+
+  std::vector<uint8_t>& m_result; // NOLINT(build/unsigned)
+  std::vector<uint8_t>* m_out;    // NOLINT(build/unsigned)
+  const FieldRegistry* m_registry;
+  FieldKind m_next_kind;                // Representation of the next value
+  const std::vector<FieldInfo>* m_next; // Record type of the next value, its items or its map values
+  std::vector<Frame> m_stack;
+  std::vector<uint8_t> m_discard; // NOLINT(build/unsigned)
+  std::string m_error;
+};
+
+inline const std::vector<FieldInfo>*
+find_root(const FieldRegistry* registry, const std::string& typestring)
+{
+  return registry && !typestring.empty() ? registry->find(typestring) : nullptr;
+}
+
+template<class Transcode>
+void
+unwrap_message(const uint8_t* msg, // NOLINT(build/unsigned)
+               std::size_t msg_size,
+               const DeserializationOptions& options,
+               Transcode& transcode);
+
+template<class Codec, class Transcode>
+void
+unwrap_compressed_message(const uint8_t* msg, // NOLINT(build/unsigned)
+                          std::size_t msg_size,
+                          const DeserializationOptions& options,
+                          Transcode& transcode)
+{
+  std::size_t inner_size = 0;
+  std::shared_ptr<uint8_t[]> inner = decompress_message<Codec>(msg, msg_size, options, inner_size); // NOLINT
+  if (!inner)
+    throw CannotTranscodeMessage(ERS_HERE, "cannot decompress the message");
+  transcode(inner.get(), inner_size);
+}
+
+/**
+ * @brief Strip a checksum from the message at @p msg and decompress it,
+ * as deserialize() does, then pass the plain message to @p transcode
+ */
+template<class Transcode>
+void
+unwrap_message(const uint8_t* msg, // NOLINT(build/unsigned)
+               std::size_t msg_size,
+               const DeserializationOptions& options,
+               Transcode& transcode)
+{
+  if (msg_size == 0)
+    throw CannotTranscodeMessage(ERS_HERE, "empty message");
+
+  switch (msg[0]) {
+    case checksum_type_byte: {
+      if (msg_size <= checksum_header_size || msg[checksum_header_size] == checksum_type_byte)
+        throw CannotTranscodeMessage(ERS_HERE, "malformed checksummed message");
+      if (options.verify_checksum) {
+        uint32_t expected = read_le32(msg + 1); // NOLINT(build/unsigned)
+        uint32_t computed = crc32c(msg + checksum_header_size, msg_size - checksum_header_size); // NOLINT
+        if (expected != computed)
+          throw ChecksumMismatch(ERS_HERE, expected, computed);
+      }
+      unwrap_message(msg + checksum_header_size, msg_size - checksum_header_size, options, transcode);
+      break;
+    }
+    case lz4_type_byte:
+      unwrap_compressed_message<Lz4Codec>(msg, msg_size, options, transcode);
+      break;
+    case zstd_type_byte:
+      unwrap_compressed_message<ZstdCodec>(msg, msg_size, options, transcode);
+      break;
+    default:
+      transcode(msg, msg_size);
+      break;
+  }
+}
+
+/**
+ * @brief Append the JSON transcoding of the plain MsgPack message at
+ * @p msg to @p out
+ */
+inline void
+append_msgpack_as_json(const uint8_t* msg, // NOLINT(build/unsigned)
+                       std::size_t msg_size,
+                       const FieldRegistry* registry,
+                       const std::string& typestring,
+                       std::vector<uint8_t>& out) // NOLINT(build/unsigned)
+{
+  if (msg[0] != serialization_type_byte(kMsgPack) && msg[0] != serialization_type_byte(kMsgPackInterned))
+    throw CannotTranscodeMessage(ERS_HERE, "not a MsgPack message");
+
+  const char* data = reinterpret_cast<const char*>(msg + 1); // NOLINT
+  const std::size_t size = msg_size - 1;
+
+  out.reserve(out.size() + 2 * size);
+  out.push_back(serialization_type_byte(kJSON));
+  JsonWriterVisitor visitor(
+    out, registry, find_root(registry, typestring), msg[0] == serialization_type_byte(kMsgPackInterned));
+  std::size_t off = 0;
+  if (!msgpack::v2::parse(data, size, off, visitor))
+    throw CannotTranscodeMessage(ERS_HERE, visitor.error().empty() ? "malformed MsgPack" : visitor.error());
+  if (off != size)
+    throw CannotTranscodeMessage(ERS_HERE, "extra bytes after the end of the message");
+}
+
+/**
+ * @brief Append the MsgPack transcoding of the plain JSON message at
+ * @p msg to @p out
+ */
+inline void
+append_json_as_msgpack(const uint8_t* msg, // NOLINT(build/unsigned)
+                       std::size_t msg_size,
+                       const FieldRegistry* registry,
+                       const std::string& typestring,
+                       std::vector<uint8_t>& out) // NOLINT(build/unsigned)
+{
+  if (msg[0] != serialization_type_byte(kJSON))
+    throw CannotTranscodeMessage(ERS_HERE, "not a JSON message");
+
+  out.reserve(out.size() + msg_size);
+  out.push_back(serialization_type_byte(kMsgPack));
+  MsgPackWriterSax sax(out, registry, find_root(registry, typestring));
+  if (!nlohmann::json::sax_parse(msg + 1, msg + msg_size, &sax))
+    throw CannotTranscodeMessage(ERS_HERE, sax.error());
+}
+
+} // namespace detail
+
+/**
+ * @brief Convert the MsgPack message @p message (serialized with
+ * kMsgPack or kMsgPackInterned) to the equivalent JSON message
+ *
+ * If @p registry has the fields of record type @p typestring, records
+ * are written as JSON objects, as serialize(kJSON) would. Otherwise,
+ * they are written as arrays. The result can be deserialized if all
+ * of the message's record types are known
+ *
+ * Checksummed and compressed messages are unwrapped as deserialize()
+ * does, using @p options: the checksum is verified (ChecksumMismatch is
+ * thrown if it doesn't match), and a compressed message is decompressed
+ * within options.max_decompressed_size. The result is then compressed
+ * and checksummed as serialize() would with @p output_options, so by
+ * default it is a plain JSON message
+ */
+template<typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+std::vector<uint8_t> // NOLINT(build/unsigned)
+msgpack_to_json(const std::vector<CharType, Alloc>& message,
+                const FieldRegistry* registry = nullptr,
+                const std::string& typestring = "",
+                const DeserializationOptions& options = DeserializationOptions(),
+                const SerializationOptions& output_options = SerializationOptions())
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(message.data()); // NOLINT
+  const std::size_t start = detail::envelope_header_size(output_options);
+  std::vector<uint8_t> ret(start); // NOLINT(build/unsigned)
+  auto transcode = [&](const uint8_t* msg, std::size_t msg_size) { // NOLINT(build/unsigned)
+    detail::append_msgpack_as_json(msg, msg_size, registry, typestring, ret);
+  };
+  detail::unwrap_message(data, message.size(), options, transcode);
+  detail::wrap_message(ret, start, output_options);
+  return ret;
+}
+
+/**
+ * @brief Convert the JSON message @p message to the equivalent
+ * kMsgPack message
+ *
+ * If @p registry has the fields of record type @p typestring, JSON
+ * objects holding records are written as MsgPack arrays with the
+ * fields in order, and arrays of bytes as BIN, as serialize(kMsgPack)
+ * would. Arrays and maps are always written with 32-bit counts, so the
+ * message may be a little larger than one from serialize()
+ *
+ * Checksums and compression are handled as in msgpack_to_json(): the
+ * input is unwrapped using @p options, and the result wrapped using
+ * @p output_options
+ */
+template<typename CharType = unsigned char, class Alloc = std::allocator<CharType>>
+std::vector<uint8_t> // NOLINT(build/unsigned)
+json_to_msgpack(const std::vector<CharType, Alloc>& message,
+                const FieldRegistry* registry = nullptr,
+                const std::string& typestring = "",
+                const DeserializationOptions& options = DeserializationOptions(),
+                const SerializationOptions& output_options = SerializationOptions())
+{
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(message.data()); // NOLINT
+  const std::size_t start = detail::envelope_header_size(output_options);
+  std::vector<uint8_t> ret(start); // NOLINT(build/unsigned)
+  auto transcode = [&](const uint8_t* msg, std::size_t msg_size) { // NOLINT(build/unsigned)
+    detail::append_json_as_msgpack(msg, msg_size, registry, typestring, ret);
+  };
+  detail::unwrap_message(data, message.size(), options, transcode);
+  detail::wrap_message(ret, start, output_options);
+  return ret;
+}
+
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_TRANSCODER_HPP_
@@ -0,0 +1,86 @@
+/**
+ * @file PmrString.hpp
+ *
+ * MsgPack adaptors for std::pmr::string, which msgpack-c only supports
+ * for std::string. std::pmr::vector needs nothing extra, since
+ * msgpack-c's std::vector adaptors take any allocator, and
+ * nlohmann::json handles both already
+ *
+ * Strings are converted in place with assign(), so they keep their
+ * allocator, and a member of a pmr-enabled type is filled from the
+ * memory resource it was constructed with
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_DETAIL_PMRSTRING_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_DETAIL_PMRSTRING_HPP_
+
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <string>
+
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+{
+  namespace adaptor {
+
+  template<>
+  struct convert<std::pmr::string>
+  {
+    msgpack::object const& operator()(msgpack::object const& o, std::pmr::string& v) const
+    {
+      switch (o.type) {
+        case msgpack::type::BIN:
+          v.assign(o.via.bin.ptr, o.via.bin.size);
+          break;
+        case msgpack::type::STR:
+          v.assign(o.via.str.ptr, o.via.str.size);
+          break;
+        default:
+          throw msgpack::type_error();
+      }
+      return o;
+    }
+  };
+
+  template<>
+  struct pack<std::pmr::string>
+  {
+    template<typename Stream>
+    packer<Stream>& operator()(msgpack::packer<Stream>& o, const std::pmr::string& v) const
+    {
+      if (v.size() > 0xffffffff)
+        throw msgpack::container_size_overflow("string size overflow");
+      o.pack_str(static_cast<uint32_t>(v.size()));    // NOLINT(build/unsigned)
+      o.pack_str_body(v.data(), static_cast<uint32_t>(v.size())); // NOLINT(build/unsigned)
+      return o;
+    }
+  };
+
+  template<>
+  struct object_with_zone<std::pmr::string>
+  {
+    void operator()(msgpack::object::with_zone& o, const std::pmr::string& v) const
+    {
+      if (v.size() > 0xffffffff)
+        throw msgpack::container_size_overflow("string size overflow");
+      uint32_t size = static_cast<uint32_t>(v.size()); // NOLINT(build/unsigned)
+      o.type = msgpack::type::STR;
+      char* ptr = static_cast<char*>(o.zone.allocate_align(size, MSGPACK_ZONE_ALIGNOF(char)));
+      o.via.str.ptr = ptr;
+      o.via.str.size = size;
+      std::memcpy(ptr, v.data(), v.size());
+    }
+  };
+
+  } // namespace adaptor
+} // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+} // namespace msgpack
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_DETAIL_PMRSTRING_HPP_
@@ -0,0 +1,334 @@
+/**
+ * @file StringTable.hpp
+ *
+ * Low-level string interning of MsgPack object trees, used by the
+ * kMsgPackInterned serialization type and by the streaming
+ * StringInternEncoder/StringInternDecoder
+ *
+ * The wire format is ordinary MsgPack in which a repeated string may
+ * be replaced by an EXT object of type intern_ref_ext_type holding
+ * the big-endian id of an earlier occurrence. Ids are assigned
+ * implicitly, in order, to every STR of at least intern_min_length
+ * bytes that appears literally, until the dictionary is full. The
+ * encoder and decoder walk the tree in the same (depth-first, map key
+ * before value) order, so the dictionary never has to be sent
+ * explicitly
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef SERIALIZATION_INCLUDE_SERIALIZATION_DETAIL_STRINGTABLE_HPP_
+#define SERIALIZATION_INCLUDE_SERIALIZATION_DETAIL_STRINGTABLE_HPP_
+
+#include "ers/Issue.hpp"
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace dunedaq {
+
+// clang-format off
+// Disable coverage collection LCOV_EXCL_START
+ERS_DECLARE_ISSUE(serialization,                                                  // namespace
+                  ReservedExtType,                                                // issue name
+                  "MsgPack EXT type " << ext_type
+                  << " is reserved for interned string references",               // message
+                  ((int)ext_type))                                                // attributes
+
+// clang-format on
+// Re-enable coverage collection LCOV_EXCL_STOP
+
+namespace serialization {
+namespace detail {
+
+/**
+ * @brief MsgPack EXT type used for references to interned
+ * strings. Messages using string interning must not otherwise contain
+ * EXT objects of this type: InternDictionary::pack() throws
+ * ReservedExtType if they do
+ */
+constexpr int8_t intern_ref_ext_type = 0x7e; // NOLINT(build/unsigned)
+
+/**
+ * @brief Strings shorter than this are never given an id: a reference
+ * would be no smaller than the string itself
+ */
+constexpr uint32_t intern_min_length = 3; // NOLINT(build/unsigned)
+
+/**
+ * @brief Number of bytes in the encoded reference to string @p id
+ */
+inline uint32_t // NOLINT(build/unsigned)
+intern_ref_size(uint32_t id) // NOLINT(build/unsigned)
+{
+  // fixext1/2/4: marker, type and the id itself
+  return id < 0x100 ? 3 : (id < 0x10000 ? 4 : 6);
+}
+
+/**
+ * @brief Number of bytes needed to encode a STR of length @p len
+ */
+inline uint32_t               // NOLINT(build/unsigned)
+str_encoded_size(uint32_t len) // NOLINT(build/unsigned)
+{
+  return len + (len < 32 ? 1 : (len < 0x100 ? 2 : (len < 0x10000 ? 3 : 5)));
+}
+
+/**
+ * @brief Encoder-side dictionary: maps strings to ids
+ *
+ * If @p owning is false, the dictionary only stores views of the
+ * strings it is given, which must then outlive it. That's the case
+ * for a single message, where the strings live in the packed buffer
+ */
+class InternDictionary
+{
+public:
+  explicit InternDictionary(std::size_t max_entries, bool owning)
+    : m_max_entries(max_entries)
+    , m_owning(owning)
+  {}
+
+  /**
+   * @brief Pack @p o to @p pk, replacing strings that were seen before
+   * with references to them
+   *
+   * Throws ReservedExtType if @p o contains an EXT of type
+   * intern_ref_ext_type, which the decoder would take for a reference.
+   * The dictionary is then left as it was before the call
+   */
+  template<typename Stream>
+  void pack(msgpack::packer<Stream>& pk, const msgpack::object& o)
+  {
+    const std::size_t committed_id = m_next_id;
+    const std::size_t committed_storage = m_storage.size();
+    // The tree is walked with an explicit stack, so that deep nesting
+    // can't overflow the call stack
+    m_stack.clear();
+    m_stack.push_back(&o);
+    while (!m_stack.empty()) {
+      const msgpack::object& cur = *m_stack.back();
+      m_stack.pop_back();
+      switch (cur.type) {
+        case msgpack::type::STR:
+          pack_str(pk, cur);
+          break;
+        case msgpack::type::ARRAY:
+          pk.pack_array(cur.via.array.size);
+          for (uint32_t i = cur.via.array.size; i > 0; --i) // NOLINT(build/unsigned)
+            m_stack.push_back(&cur.via.array.ptr[i - 1]);
+          break;
+        case msgpack::type::MAP:
+          pk.pack_map(cur.via.map.size);
+          for (uint32_t i = cur.via.map.size; i > 0; --i) { // NOLINT(build/unsigned)
+            m_stack.push_back(&cur.via.map.ptr[i - 1].val);
+            m_stack.push_back(&cur.via.map.ptr[i - 1].key);
+          }
+          break;
+        case msgpack::type::EXT:
+          if (cur.via.ext.type() == intern_ref_ext_type) {
+            rollback(committed_id, committed_storage);
+            throw ReservedExtType(ERS_HERE, intern_ref_ext_type);
+          }
+          pk.pack(cur);
+          break;
+        default:
+          pk.pack(cur);
+          break;
+      }
+    }
+  }
+
+  std::size_t size() const { return m_next_id; }
+
+  void clear()
+  {
+    m_ids.clear();
+    m_storage.clear();
+    m_next_id = 0;
+  }
+
+private:
+  // Forget the ids given out since the dictionary had @p next_id
+  // entries, of which @p storage_size were stored
+  void rollback(std::size_t next_id, std::size_t storage_size)
+  {
+    for (auto it = m_ids.begin(); it != m_ids.end();) {
+      if (it->second >= next_id)
+        it = m_ids.erase(it);
+      else
+        ++it;
+    }
+    m_storage.resize(storage_size);
+    m_next_id = next_id;
+  }
+
+  template<typename Stream>
+  void pack_str(msgpack::packer<Stream>& pk, const msgpack::object& o)
+  {
+    std::string_view s(o.via.str.ptr, o.via.str.size);
+    if (s.size() >= intern_min_length) {
+      auto it = m_ids.find(s);
+      if (it != m_ids.end() && intern_ref_size(it->second) < str_encoded_size(o.via.str.size)) {
+        pack_ref(pk, it->second);
+        return;
+      }
+      // Every literal eligible string takes an id, even if it's a
+      // duplicate, because that's what the decoder will do
+      if (m_next_id < m_max_entries) {
+        if (it == m_ids.end()) {
+          if (m_owning)
+            s = m_storage.emplace_back(s);
+          m_ids.emplace(s, static_cast<uint32_t>(m_next_id)); // NOLINT(build/unsigned)
+        }
+        ++m_next_id;
+      }
+    }
+    pk.pack_str(o.via.str.size);
+    pk.pack_str_body(o.via.str.ptr, o.via.str.size);
+  }
+
+  template<typename Stream>
+  static void pack_ref(msgpack::packer<Stream>& pk, uint32_t id) // NOLINT(build/unsigned)
+  {
+    char buf[4];
+    uint32_t n = intern_ref_size(id) - 2; // NOLINT(build/unsigned)
+    for (uint32_t i = 0; i < n; ++i)      // NOLINT(build/unsigned)
+      buf[i] = static_cast<char>(id >> (8 * (n - 1 - i)));
+    pk.pack_ext(n, intern_ref_ext_type);
+    pk.pack_ext_body(buf, n);
+  }
+
+  std::size_t m_max_entries;
+  bool m_owning;
+  std::size_t m_next_id = 0;
+  std::unordered_map<std::string_view, uint32_t> m_ids; // NOLINT(build/unsigned)
+  std::deque<std::string> m_storage;
+  std::vector<const msgpack::object*> m_stack;
+};
+
+/**
+ * @brief Decoder-side dictionary: maps ids to strings
+ *
+ * If @p owning is false, the table only stores pointers into the
+ * message being decoded
+ */
+class InternTable
+{
+public:
+  explicit InternTable(std::size_t max_entries, bool owning)
+    : m_max_entries(max_entries)
+    , m_owning(owning)
+  {}
+
+  /**
+   * @brief Replace every string reference in the tree rooted at @p o
+   * with a STR object pointing at the referenced string. The tree is
+   * modified in place. Returns false if a reference is invalid
+   */
+  bool resolve(msgpack::object& o)
+  {
+    // The tree is walked with an explicit stack, in the same order as
+    // InternDictionary::pack(), so that deep nesting in a hostile
+    // message can't overflow the call stack
+    m_stack.clear();
+    m_stack.push_back(&o);
+    while (!m_stack.empty()) {
+      msgpack::object& cur = *m_stack.back();
+      m_stack.pop_back();
+      switch (cur.type) {
+        case msgpack::type::STR:
+          add_entry(cur);
+          break;
+        case msgpack::type::EXT:
+          if (!resolve_ref(cur))
+            return false;
+          break;
+        case msgpack::type::ARRAY:
+          for (uint32_t i = cur.via.array.size; i > 0; --i) // NOLINT(build/unsigned)
+            m_stack.push_back(&cur.via.array.ptr[i - 1]);
+          break;
+        case msgpack::type::MAP:
+          for (uint32_t i = cur.via.map.size; i > 0; --i) { // NOLINT(build/unsigned)
+            m_stack.push_back(&cur.via.map.ptr[i - 1].val);
+            m_stack.push_back(&cur.via.map.ptr[i - 1].key);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    return true;
+  }
+
+  std::size_t size() const { return m_entries.size(); }
+
+  /**
+   * @brief Forget all but the first @p size entries, eg those added by
+   * a message that turned out to be invalid
+   */
+  void truncate(std::size_t size)
+  {
+    if (size >= m_entries.size())
+      return;
+    m_entries.resize(size);
+    if (m_owning)
+      m_storage.resize(size);
+  }
+
+  void clear()
+  {
+    m_entries.clear();
+    m_storage.clear();
+  }
+
+private:
+  void add_entry(const msgpack::object& o)
+  {
+    if (o.via.str.size < intern_min_length || m_entries.size() >= m_max_entries)
+      return;
+    if (m_owning) {
+      const std::string& s = m_storage.emplace_back(o.via.str.ptr, o.via.str.size);
+      m_entries.emplace_back(s);
+    } else {
+      m_entries.emplace_back(o.via.str.ptr, o.via.str.size);
+    }
+  }
+
+  bool resolve_ref(msgpack::object& o)
+  {
+    if (o.via.ext.type() != intern_ref_ext_type)
+      return true;
+    uint32_t n = o.via.ext.size; // NOLINT(build/unsigned)
+    if (n != 1 && n != 2 && n != 4)
+      return false;
+    uint32_t id = 0;                 // NOLINT(build/unsigned)
+    for (uint32_t i = 0; i < n; ++i) // NOLINT(build/unsigned)
+      id = (id << 8) | static_cast<uint8_t>(o.via.ext.data()[i]); // NOLINT(build/unsigned)
+    if (id >= m_entries.size())
+      return false;
+    o.type = msgpack::type::STR;
+    o.via.str.ptr = m_entries[id].data();
+    o.via.str.size = static_cast<uint32_t>(m_entries[id].size()); // NOLINT(build/unsigned)
+    return true;
+  }
+
+  std::size_t m_max_entries;
+  bool m_owning;
+  std::vector<std::string_view> m_entries;
+  std::deque<std::string> m_storage;
+  std::vector<msgpack::object*> m_stack;
+};
+
+} // namespace detail
+} // namespace serialization
+} // namespace dunedaq
+
+#endif // SERIALIZATION_INCLUDE_SERIALIZATION_DETAIL_STRINGTABLE_HPP_
@@ -0,0 +1,106 @@
+/**
+ * @file async_serialization_speed.cxx
+ *
+ * Compare end-to-end throughput of inline serialization with the
+ * AsyncSerializer worker pool
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "logging/Logging.hpp"
+#include "serialization/AsyncSerializer.hpp"
+#include "serialization/Serialization.hpp"
+#include "serialization/fsd/MsgP.hpp"
+#include "serialization/fsd/Nljs.hpp"
+#include "serialization/fsd/Structs.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using AnotherFakeData = dunedaq::serialization::fsd::AnotherFakeData;
+using FakeData = dunedaq::serialization::fsd::FakeData;
+
+// Return the current steady clock in microseconds
+inline uint64_t // NOLINT(build/unsigned)
+now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+AnotherFakeData
+make_message(int i)
+{
+  AnotherFakeData fd;
+  fd.fake_count = i;
+  fd.fakeness = dunedaq::serialization::fsd::Fakeness::SuperFake;
+  for (int j = 0; j < 200; ++j) {
+    fd.fake_datas.push_back(FakeData{ j });
+  }
+  return fd;
+}
+
+void
+report(const std::string& name, int n, uint64_t bytes, uint64_t start_time) // NOLINT(build/unsigned)
+{
+  uint64_t end_time = now_us(); // NOLINT(build/unsigned)
+  double time_taken_s = 1e-6 * (end_time - start_time);
+  TLOG() << name << ": " << n << " messages (" << bytes << " bytes) in " << time_taken_s << " s ("
+         << 1e-3 * n / time_taken_s << " kHz)";
+}
+
+void
+time_inline(dunedaq::serialization::SerializationType stype, int n)
+{
+  uint64_t total_bytes = 0;       // NOLINT(build/unsigned)
+  uint64_t start_time = now_us(); // NOLINT(build/unsigned)
+  for (int i = 0; i < n; ++i) {
+    std::vector<uint8_t> bytes = dunedaq::serialization::serialize(make_message(i), stype); // NOLINT(build/unsigned)
+    total_bytes += bytes.size();
+  }
+  report("Inline", n, total_bytes, start_time);
+}
+
+void
+time_async(dunedaq::serialization::SerializationType stype, int n, int n_workers)
+{
+  using namespace dunedaq::serialization;
+  std::atomic<uint64_t> total_bytes{ 0 }; // NOLINT(build/unsigned)
+  uint64_t start_time = now_us();         // NOLINT(build/unsigned)
+  AsyncSerializerMetrics metrics;
+  {
+    AsyncSerializer<AnotherFakeData> async(stype, n_workers);
+    auto producer = async.make_producer();
+    for (int i = 0; i < n; ++i) {
+      producer.submit(make_message(i), [&total_bytes](PooledBuffer&& buf, std::exception_ptr) {
+        total_bytes.fetch_add(buf.size(), std::memory_order_relaxed);
+      });
+    }
+    metrics = async.get_metrics();
+    // The destructor waits for the queue to drain
+  }
+  report("Async (" + std::to_string(n_workers) + " workers)", n, total_bytes.load(), start_time);
+  TLOG() << "  max queue depth " << metrics.max_queue_depth << "/" << metrics.queue_capacity << ", "
+         << metrics.backpressure_waits << " backpressure waits";
+}
+
+int
+main(int argc, char* argv[])
+{
+  const int n = 100000;
+  int max_workers = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+
+  for (auto stype : { dunedaq::serialization::kMsgPack, dunedaq::serialization::kJSON }) {
+    TLOG() << (stype == dunedaq::serialization::kMsgPack ? "MsgPack:" : "JSON:");
+    time_inline(stype, n);
+    for (int n_workers = 1; n_workers <= max_workers; n_workers *= 2) {
+      time_async(stype, n, n_workers);
+    }
+  }
+}
@@ -0,0 +1,83 @@
+/**
+ * @file checksum_speed.cxx
+ *
+ * Measure CRC32C throughput, and the cost of a checksum on
+ * serialization and deserialization of a large payload
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "logging/Logging.hpp"
+#include "serialization/Checksum.hpp"
+#include "serialization/Serialization.hpp"
+
+#include <chrono>
+#include <numeric>
+#include <string>
+#include <vector>
+
+struct Payload
+{
+  int run;
+  std::vector<uint8_t> data; // NOLINT(build/unsigned)
+
+  DUNE_DAQ_SERIALIZE(Payload, run, data);
+};
+
+// Return the current steady clock in microseconds
+inline uint64_t // NOLINT(build/unsigned)
+now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int
+main()
+{
+  namespace ser = dunedaq::serialization;
+  const int N = 100;
+
+  Payload p;
+  p.run = 1;
+  p.data.resize(16 * 1024 * 1024);
+  std::iota(p.data.begin(), p.data.end(), 0);
+  const double gb = 1e-9 * N * p.data.size();
+
+  uint32_t crc = 0;               // NOLINT(build/unsigned)
+  uint64_t start_time = now_us(); // NOLINT(build/unsigned)
+  for (int i = 0; i < N; ++i) {
+    crc = ser::crc32c(p.data.data(), p.data.size(), crc);
+  }
+  double hw_s = 1e-6 * (now_us() - start_time);
+
+  start_time = now_us();
+  for (int i = 0; i < N; ++i) {
+    crc = ~ser::detail::crc32c_sw(~crc, p.data.data(), p.data.size());
+  }
+  double sw_s = 1e-6 * (now_us() - start_time);
+
+  TLOG() << "CRC32C: " << gb / hw_s << " GB/s (hardware " << (ser::detail::crc32c_hw_available() ? "on" : "off")
+         << "), software fallback " << gb / sw_s << " GB/s (crc " << crc << ")";
+
+  std::vector<uint8_t> bytes; // NOLINT(build/unsigned)
+  for (auto checksum : { ser::kNoChecksum, ser::kCRC32C }) {
+    std::string name = checksum == ser::kCRC32C ? "with CRC32C" : "no checksum";
+
+    start_time = now_us();
+    for (int i = 0; i < N; ++i) {
+      ser::serialize_into(p, ser::kMsgPack, bytes, { checksum });
+    }
+    double ser_s = 1e-6 * (now_us() - start_time);
+
+    start_time = now_us();
+    for (int i = 0; i < N; ++i) {
+      Payload p_deserialized = ser::deserialize<Payload>(bytes);
+    }
+    double deser_s = 1e-6 * (now_us() - start_time);
+
+    TLOG() << "MsgPack " << name << ": serialize " << gb / ser_s << " GB/s, deserialize " << gb / deser_s << " GB/s";
+  }
+}
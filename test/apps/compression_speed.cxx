@@ -0,0 +1,118 @@
+/**
+ * @file compression_speed.cxx
+ *
+ * Compare message size and serialization/deserialization throughput
+ * with no compression, LZ4 and zstd, for the fsd test types and for a
+ * large waveform-like blob
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "logging/Logging.hpp"
+#include "serialization/Serialization.hpp"
+#include "serialization/fsd/MsgP.hpp"
+#include "serialization/fsd/Nljs.hpp"
+#include "serialization/fsd/Structs.hpp"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+using AnotherFakeData = dunedaq::serialization::fsd::AnotherFakeData;
+using FakeData = dunedaq::serialization::fsd::FakeData;
+
+struct Waveform
+{
+  int channel;
+  std::vector<uint16_t> adcs; // NOLINT(build/unsigned)
+
+  DUNE_DAQ_SERIALIZE(Waveform, channel, adcs);
+};
+
+// Return the current steady clock in microseconds
+inline uint64_t // NOLINT(build/unsigned)
+now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool
+codec_available(dunedaq::serialization::CompressionMode mode)
+{
+  namespace ser = dunedaq::serialization;
+  switch (mode) {
+    case ser::kLZ4:
+      return ser::detail::Lz4Codec::available;
+    case ser::kZstd:
+      return ser::detail::ZstdCodec::available;
+    default:
+      return true;
+  }
+}
+
+template<class T>
+void
+time_compression(const std::string& name, const T& obj, dunedaq::serialization::SerializationType stype, int n)
+{
+  namespace ser = dunedaq::serialization;
+  const std::size_t plain_size = ser::serialize(obj, stype).size();
+
+  std::vector<uint8_t> bytes; // NOLINT(build/unsigned)
+  for (auto mode : { ser::kNoCompression, ser::kLZ4, ser::kZstd }) {
+    std::string mode_name = mode == ser::kLZ4 ? "LZ4" : mode == ser::kZstd ? "zstd" : "none";
+    if (!codec_available(mode)) {
+      TLOG() << name << ", " << mode_name << ": not available in this build";
+      continue;
+    }
+    ser::SerializationOptions options;
+    options.compression = mode;
+
+    uint64_t start_time = now_us(); // NOLINT(build/unsigned)
+    for (int i = 0; i < n; ++i) {
+      ser::serialize_into(obj, stype, bytes, options);
+    }
+    double ser_s = 1e-6 * (now_us() - start_time);
+
+    start_time = now_us();
+    for (int i = 0; i < n; ++i) {
+      T obj_deserialized = ser::deserialize<T>(bytes);
+    }
+    double deser_s = 1e-6 * (now_us() - start_time);
+
+    // Throughput is in terms of the uncompressed message
+    double mb = 1e-6 * n * plain_size;
+    TLOG() << name << ", " << mode_name << ": " << bytes.size() << " bytes (ratio "
+           << static_cast<double>(plain_size) / bytes.size() << "), serialize " << mb / ser_s
+           << " MB/s, deserialize " << mb / deser_s << " MB/s";
+  }
+}
+
+int
+main()
+{
+  namespace ser = dunedaq::serialization;
+
+  AnotherFakeData fd;
+  fd.fake_count = 12;
+  fd.fake_timestamp = 123456789;
+  fd.fakeness = dunedaq::serialization::fsd::Fakeness::SuperFake;
+  for (int j = 0; j < 5000; ++j) {
+    fd.fake_datas.push_back(FakeData{ j % 100 });
+  }
+  time_compression("AnotherFakeData JSON", fd, ser::kJSON, 500);
+  time_compression("AnotherFakeData MsgPack", fd, ser::kMsgPack, 500);
+
+  // A baseline with small noise, as from a quiet detector channel
+  Waveform w;
+  w.channel = 3;
+  std::mt19937 rng(1);
+  std::normal_distribution<double> noise(0, 3);
+  for (int i = 0; i < 8 * 1024 * 1024; ++i) {
+    w.adcs.push_back(static_cast<uint16_t>(900 + noise(rng))); // NOLINT(build/unsigned)
+  }
+  time_compression("Waveform MsgPack", w, ser::kMsgPack, 20);
+}
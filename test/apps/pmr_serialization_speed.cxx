@@ -0,0 +1,174 @@
+/**
+ * @file pmr_serialization_speed.cxx
+ *
+ * Compare serializing and deserializing an "event" of many messages
+ * with the default allocator, and with all of the event's memory
+ * taken from a std::pmr::monotonic_buffer_resource that is released in
+ * one go at the end of the event. Each row adds one change to the one
+ * before, so that decoding in place, reusing one msgpack::zone and
+ * the arena are measured separately
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "logging/Logging.hpp"
+#include "serialization/Serialization.hpp"
+
+#include <chrono>
+#include <memory_resource>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct Hit
+{
+  int channel;
+  std::string source;
+  std::vector<int> adcs;
+
+  DUNE_DAQ_SERIALIZE(Hit, channel, source, adcs);
+};
+
+struct PmrHit
+{
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  int channel = 0;
+  std::pmr::string source;
+  std::pmr::vector<int> adcs;
+
+  PmrHit() = default;
+  explicit PmrHit(const allocator_type& alloc)
+    : source(alloc)
+    , adcs(alloc)
+  {}
+  // Allocator-extended copy and move, needed to live in a std::pmr::vector
+  PmrHit(const PmrHit& other, const allocator_type& alloc)
+    : channel(other.channel)
+    , source(other.source, alloc)
+    , adcs(other.adcs, alloc)
+  {}
+  PmrHit(PmrHit&& other, const allocator_type& alloc)
+    : channel(other.channel)
+    , source(std::move(other.source), alloc)
+    , adcs(std::move(other.adcs), alloc)
+  {}
+  PmrHit(const PmrHit&) = default;
+  PmrHit(PmrHit&&) = default;
+  PmrHit& operator=(const PmrHit&) = default;
+  PmrHit& operator=(PmrHit&&) = default;
+
+  DUNE_DAQ_SERIALIZE(PmrHit, channel, source, adcs);
+};
+
+const int n_events = 200;
+const int n_messages = 1000;
+
+// Return the current steady clock in microseconds
+inline uint64_t // NOLINT(build/unsigned)
+now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Run @p event n_events times, and return the rate of messages in kHz
+template<class Event>
+double
+rate_khz(Event event)
+{
+  uint64_t start_time = now_us(); // NOLINT(build/unsigned)
+  for (int ev = 0; ev < n_events; ++ev) {
+    event();
+  }
+  return 1e-3 * n_events * n_messages / (1e-6 * (now_us() - start_time));
+}
+
+int
+main()
+{
+  namespace ser = dunedaq::serialization;
+
+  Hit hit;
+  hit.channel = 7;
+  hit.source = "detector_readout_crate_1_link_3";
+  hit.adcs.assign(64, 1000);
+
+  for (auto stype : { ser::kMsgPack, ser::kJSON }) {
+    std::string prefix = stype == ser::kMsgPack ? "MsgPack" : "JSON";
+
+    // Default allocator: every message and every decoded member is a
+    // separate allocation and deallocation, and each MsgPack message
+    // gets a new zone
+    double default_khz = rate_khz([&]() {
+      std::vector<std::vector<uint8_t>> messages; // NOLINT(build/unsigned)
+      std::vector<Hit> hits;
+      messages.reserve(n_messages);
+      hits.reserve(n_messages);
+      for (int i = 0; i < n_messages; ++i) {
+        ser::serialize_into(hit, stype, messages.emplace_back());
+      }
+      for (auto& m : messages) {
+        hits.push_back(ser::deserialize<Hit>(m));
+      }
+    });
+
+    // The same, decoding each message straight into its place in the
+    // vector of hits
+    double into_khz = rate_khz([&]() {
+      std::vector<std::vector<uint8_t>> messages; // NOLINT(build/unsigned)
+      std::vector<Hit> hits;
+      messages.reserve(n_messages);
+      hits.reserve(n_messages);
+      for (int i = 0; i < n_messages; ++i) {
+        ser::serialize_into(hit, stype, messages.emplace_back());
+      }
+      for (auto& m : messages) {
+        ser::deserialize_into(m, hits.emplace_back());
+      }
+    });
+
+    // ...and reusing one zone for every MsgPack message
+    msgpack::zone zone;
+    ser::DeserializationOptions options;
+    options.zone = &zone;
+    double zone_khz = rate_khz([&]() {
+      std::vector<std::vector<uint8_t>> messages; // NOLINT(build/unsigned)
+      std::vector<Hit> hits;
+      messages.reserve(n_messages);
+      hits.reserve(n_messages);
+      for (int i = 0; i < n_messages; ++i) {
+        ser::serialize_into(hit, stype, messages.emplace_back());
+      }
+      for (auto& m : messages) {
+        ser::deserialize_into(m, hits.emplace_back(), options);
+        zone.clear();
+      }
+    });
+
+    // ...and an arena per event: the messages and decoded hits all
+    // come from the arena, and are freed together when it goes out of
+    // scope
+    double arena_khz = rate_khz([&]() {
+      std::pmr::monotonic_buffer_resource arena(1 << 20);
+      std::pmr::vector<std::pmr::vector<uint8_t>> messages(&arena); // NOLINT(build/unsigned)
+      std::pmr::vector<PmrHit> hits(&arena);
+      messages.reserve(n_messages);
+      hits.reserve(n_messages);
+      for (int i = 0; i < n_messages; ++i) {
+        ser::serialize_into(hit, stype, messages.emplace_back());
+      }
+      for (auto& m : messages) {
+        ser::deserialize_into(m, hits.emplace_back(), options);
+        zone.clear();
+      }
+    });
+
+    TLOG() << prefix << ": default allocator, deserialize() " << default_khz << " kHz";
+    TLOG() << prefix << ": default allocator, deserialize_into() " << into_khz << " kHz";
+    TLOG() << prefix << ": default allocator, deserialize_into(), reused zone " << zone_khz << " kHz";
+    TLOG() << prefix << ": per-event arena, deserialize_into(), reused zone " << arena_khz << " kHz";
+  }
+}
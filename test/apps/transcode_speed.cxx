@@ -0,0 +1,102 @@
+/**
+ * @file transcode_speed.cxx
+ *
+ * Compare converting MsgPack messages to JSON with the streaming
+ * transcoder, and by deserializing to the C++ type and serializing
+ * again
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "logging/Logging.hpp"
+#include "serialization/Serialization.hpp"
+#include "serialization/Transcoder.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+struct Hit
+{
+  int channel;
+  double adc;
+  std::string source;
+
+  DUNE_DAQ_SERIALIZE(Hit, channel, adc, source);
+};
+
+struct Trigger
+{
+  int64_t timestamp;
+  std::vector<Hit> hits;
+
+  DUNE_DAQ_SERIALIZE(Trigger, timestamp, hits);
+};
+
+DUNE_DAQ_TYPESTRING(Trigger, "Trigger");
+
+// Return the current steady clock in microseconds
+inline uint64_t // NOLINT(build/unsigned)
+now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int
+main()
+{
+  namespace ser = dunedaq::serialization;
+  const int N = 10000;
+
+  Trigger t;
+  t.timestamp = 123456789;
+  for (int i = 0; i < 100; ++i) {
+    t.hits.push_back(Hit{ i, 0.5 * i, "crate_" + std::to_string(i % 4) });
+  }
+  std::vector<uint8_t> bytes = ser::serialize(t, ser::kMsgPack); // NOLINT(build/unsigned)
+
+  ser::FieldRegistry registry;
+  registry.add<Trigger>();
+
+  std::size_t total = 0;
+  uint64_t start_time = now_us(); // NOLINT(build/unsigned)
+  for (int i = 0; i < N; ++i) {
+    total += ser::serialize(ser::deserialize<Trigger>(bytes), ser::kJSON).size();
+  }
+  double roundtrip_s = 1e-6 * (now_us() - start_time);
+
+  start_time = now_us();
+  for (int i = 0; i < N; ++i) {
+    total += ser::msgpack_to_json(bytes, &registry, "Trigger").size();
+  }
+  double transcode_s = 1e-6 * (now_us() - start_time);
+
+  start_time = now_us();
+  for (int i = 0; i < N; ++i) {
+    total += ser::msgpack_to_json(bytes).size();
+  }
+  double anonymous_s = 1e-6 * (now_us() - start_time);
+
+  TLOG() << "MsgPack to JSON, " << bytes.size() << "-byte message: deserialize+serialize " << 1e-3 * N / roundtrip_s
+         << " kHz, transcoder " << 1e-3 * N / transcode_s << " kHz, transcoder without field names "
+         << 1e-3 * N / anonymous_s << " kHz (" << total << " bytes written)";
+
+  std::vector<uint8_t> json_bytes = ser::serialize(t, ser::kJSON); // NOLINT(build/unsigned)
+  start_time = now_us();
+  for (int i = 0; i < N; ++i) {
+    total += ser::serialize(ser::deserialize<Trigger>(json_bytes), ser::kMsgPack).size();
+  }
+  roundtrip_s = 1e-6 * (now_us() - start_time);
+
+  start_time = now_us();
+  for (int i = 0; i < N; ++i) {
+    total += ser::json_to_msgpack(json_bytes, &registry, "Trigger").size();
+  }
+  transcode_s = 1e-6 * (now_us() - start_time);
+
+  TLOG() << "JSON to MsgPack: deserialize+serialize " << 1e-3 * N / roundtrip_s << " kHz, transcoder "
+         << 1e-3 * N / transcode_s << " kHz (" << total << " bytes written)";
+}
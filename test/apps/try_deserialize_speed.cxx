@@ -0,0 +1,93 @@
+/**
+ * @file try_deserialize_speed.cxx
+ *
+ * Compare the cost of rejecting corrupt messages with the throwing
+ * deserialize() and the non-throwing try_deserialize()
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "logging/Logging.hpp"
+#include "serialization/Serialization.hpp"
+#include "serialization/fsd/MsgP.hpp"
+#include "serialization/fsd/Nljs.hpp"
+#include "serialization/fsd/Structs.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using AnotherFakeData = dunedaq::serialization::fsd::AnotherFakeData;
+using FakeData = dunedaq::serialization::fsd::FakeData;
+
+// Return the current steady clock in microseconds
+inline uint64_t // NOLINT(build/unsigned)
+now_us()
+{
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void
+time_both(const std::string& name, const std::vector<uint8_t>& bytes) // NOLINT(build/unsigned)
+{
+  namespace ser = dunedaq::serialization;
+  const int N = 100000;
+
+  int n_failed = 0;
+  uint64_t start_time = now_us(); // NOLINT(build/unsigned)
+  for (int i = 0; i < N; ++i) {
+    try {
+      AnotherFakeData fd = ser::deserialize<AnotherFakeData>(bytes);
+    } catch (ers::Issue&) {
+      ++n_failed;
+    }
+  }
+  double throwing_s = 1e-6 * (now_us() - start_time);
+
+  int n_failed_try = 0;
+  start_time = now_us();
+  for (int i = 0; i < N; ++i) {
+    if (!ser::try_deserialize<AnotherFakeData>(bytes))
+      ++n_failed_try;
+  }
+  double try_s = 1e-6 * (now_us() - start_time);
+
+  TLOG() << name << ": deserialize() " << 1e-3 * N / throwing_s << " kHz (" << n_failed << " failed), "
+         << "try_deserialize() " << 1e-3 * N / try_s << " kHz (" << n_failed_try << " failed)";
+}
+
+int
+main()
+{
+  namespace ser = dunedaq::serialization;
+
+  AnotherFakeData fd;
+  fd.fake_count = 3;
+  fd.fakeness = ser::fsd::Fakeness::SuperFake;
+  for (int i = 0; i < 20; ++i) {
+    fd.fake_datas.push_back(FakeData{ i });
+  }
+
+  for (auto stype : { ser::kMsgPack, ser::kJSON }) {
+    std::string prefix = stype == ser::kMsgPack ? "MsgPack " : "JSON ";
+    std::vector<uint8_t> good = ser::serialize(fd, stype); // NOLINT(build/unsigned)
+    time_both(prefix + "valid message", good);
+
+    std::vector<uint8_t> truncated(good.begin(), good.begin() + good.size() / 2); // NOLINT(build/unsigned)
+    time_both(prefix + "truncated message", truncated);
+
+    std::vector<uint8_t> garbage = good; // NOLINT(build/unsigned)
+    for (size_t i = 1; i < garbage.size(); i += 3)
+      garbage[i] = 0xc1;
+    time_both(prefix + "corrupted message", garbage);
+
+    std::vector<uint8_t> misrouted = ser::serialize(std::string("a message of some other type"), stype); // NOLINT
+    time_both(prefix + "misrouted message", misrouted);
+  }
+
+  std::vector<uint8_t> bad_byte = { 'X', 0x00, 0x01 }; // NOLINT(build/unsigned)
+  time_both("Bad format byte", bad_byte);
+}
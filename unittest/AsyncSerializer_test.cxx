@@ -0,0 +1,204 @@
+/**
+ * @file AsyncSerializer_test.cxx AsyncSerializer class Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/AsyncSerializer.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE AsyncSerializer_test // NOLINT
+
+#include "boost/test/data/test_case.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MyTypeIntrusive
+{
+  int count;
+  std::string name;
+  std::vector<double> values;
+
+  DUNE_DAQ_SERIALIZE(MyTypeIntrusive, count, name, values);
+};
+
+namespace ser = dunedaq::serialization;
+
+BOOST_AUTO_TEST_SUITE(AsyncSerializer_test)
+
+BOOST_DATA_TEST_CASE(FutureRoundTrip, boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON }))
+{
+  ser::AsyncSerializer<MyTypeIntrusive> async(sample, 2);
+  auto producer = async.make_producer();
+
+  MyTypeIntrusive m;
+  m.count = 3;
+  m.name = "foo";
+  m.values = { 3.1416, 2.781 };
+  MyTypeIntrusive m_copy = m;
+
+  std::future<ser::PooledBuffer> fut = producer.submit(std::move(m));
+  ser::PooledBuffer buf = fut.get();
+  BOOST_CHECK(buf.bytes() == ser::serialize(m_copy, sample));
+
+  MyTypeIntrusive m_recv = ser::deserialize<MyTypeIntrusive>(buf.bytes());
+  BOOST_CHECK_EQUAL(m_recv.count, m_copy.count);
+  BOOST_CHECK_EQUAL(m_recv.name, m_copy.name);
+  BOOST_CHECK_EQUAL_COLLECTIONS(m_recv.values.begin(), m_recv.values.end(), m_copy.values.begin(), m_copy.values.end());
+}
+
+/**
+ * @brief Check that results come back in submission order for each
+ * producer, even with several workers and a queue small enough to
+ * cause backpressure
+ */
+BOOST_AUTO_TEST_CASE(PerProducerOrdering)
+{
+  const int n_producers = 3;
+  const int n_messages = 5000;
+  std::vector<std::vector<int>> received(n_producers);
+
+  ser::AsyncSerializerMetrics metrics;
+  {
+    ser::AsyncSerializer<MyTypeIntrusive> async(ser::kMsgPack, 4, 8);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < n_producers; ++p) {
+      threads.emplace_back([&, p] {
+        auto producer = async.make_producer();
+        for (int i = 0; i < n_messages; ++i) {
+          producer.submit(MyTypeIntrusive{ i, "foo", {} }, [&, p](ser::PooledBuffer&& buf, std::exception_ptr err) {
+            // Callbacks for one producer never run concurrently, so no lock is needed here
+            received[p].push_back(err ? -1 : ser::deserialize<MyTypeIntrusive>(buf.bytes()).count);
+          });
+        }
+      });
+    }
+    for (auto& t : threads)
+      t.join();
+    // Wait for everything to drain by round-tripping one more message
+    async.make_producer().submit(MyTypeIntrusive{}).get();
+    while (async.get_metrics().completed < static_cast<uint64_t>(n_producers * n_messages + 1)) // NOLINT(build/unsigned)
+      std::this_thread::yield();
+    metrics = async.get_metrics();
+  }
+
+  for (int p = 0; p < n_producers; ++p) {
+    BOOST_REQUIRE_EQUAL(received[p].size(), static_cast<size_t>(n_messages));
+    for (int i = 0; i < n_messages; ++i)
+      BOOST_REQUIRE_EQUAL(received[p][i], i);
+  }
+  BOOST_CHECK_EQUAL(metrics.submitted, static_cast<uint64_t>(n_producers * n_messages + 1)); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(metrics.failed, 0u);
+  BOOST_CHECK_EQUAL(metrics.queue_capacity, 8u);
+  BOOST_CHECK_LE(metrics.max_queue_depth, metrics.queue_capacity);
+}
+
+BOOST_AUTO_TEST_CASE(TrySubmitRejectsWhenFull)
+{
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+
+  ser::AsyncSerializer<MyTypeIntrusive> async(ser::kMsgPack, 1, 2);
+  auto producer = async.make_producer();
+
+  // The first callback blocks the only worker, so the queue fills up
+  producer.submit(MyTypeIntrusive{ 0, "blocker", {} },
+                  [released](ser::PooledBuffer&&, std::exception_ptr) { released.wait(); });
+
+  bool rejected = false;
+  for (int i = 1; i < 10 && !rejected; ++i) {
+    MyTypeIntrusive m{ i, "foo", {} };
+    rejected = !producer.try_submit(std::move(m), nullptr);
+    if (rejected) {
+      // A rejected object is handed back untouched
+      BOOST_CHECK_EQUAL(m.name, "foo");
+    }
+  }
+  BOOST_CHECK(rejected);
+  BOOST_CHECK_EQUAL(async.get_metrics().rejected, 1u);
+
+  release.set_value();
+  BOOST_CHECK_EQUAL(producer.submit(MyTypeIntrusive{}).get().bytes()[0], ser::serialization_type_byte(ser::kMsgPack));
+}
+
+BOOST_AUTO_TEST_CASE(CallbackCanSubmit)
+{
+  ser::AsyncSerializer<MyTypeIntrusive> async(ser::kMsgPack, 1);
+  auto producer = async.make_producer();
+
+  // Callbacks run without the producer's lock held, so they can
+  // submit follow-up messages through the same producer
+  std::promise<int> done;
+  producer.submit(MyTypeIntrusive{ 1, "first", {} }, [&](ser::PooledBuffer&&, std::exception_ptr) {
+    producer.submit(MyTypeIntrusive{ 2, "second", {} }, [&](ser::PooledBuffer&& buf, std::exception_ptr) {
+      done.set_value(ser::deserialize<MyTypeIntrusive>(buf.bytes()).count);
+    });
+  });
+  auto fut = done.get_future();
+  BOOST_REQUIRE(fut.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+  BOOST_CHECK_EQUAL(fut.get(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(CallbackSubmitsToFullQueue)
+{
+  // One worker and a tiny queue: the worker is busy in the callback,
+  // so nothing else would ever free a slot
+  ser::AsyncSerializer<MyTypeIntrusive> async(ser::kMsgPack, 1, 2);
+  auto producer = async.make_producer();
+
+  const int n = 10;
+  std::vector<int> counts;
+  std::promise<void> done;
+  producer.submit(MyTypeIntrusive{ 0, "first", {} }, [&](ser::PooledBuffer&&, std::exception_ptr) {
+    for (int i = 1; i <= n; ++i) {
+      producer.submit(MyTypeIntrusive{ i, "next", {} }, [&](ser::PooledBuffer&& buf, std::exception_ptr) {
+        counts.push_back(ser::deserialize<MyTypeIntrusive>(buf.bytes()).count);
+        if (counts.size() == n)
+          done.set_value();
+      });
+    }
+  });
+  auto fut = done.get_future();
+  BOOST_REQUIRE(fut.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+  // Still in submission order
+  for (int i = 0; i < n; ++i)
+    BOOST_CHECK_EQUAL(counts[i], i + 1);
+}
+
+BOOST_AUTO_TEST_CASE(CallbackExceptionsAreCaught)
+{
+  ser::AsyncSerializer<MyTypeIntrusive> async(ser::kMsgPack, 1);
+  auto producer = async.make_producer();
+
+  producer.submit(MyTypeIntrusive{ 1, "foo", {} },
+                  [](ser::PooledBuffer&&, std::exception_ptr) { throw std::runtime_error("callback failed"); });
+  // Later results are still delivered
+  BOOST_CHECK_EQUAL(producer.submit(MyTypeIntrusive{}).get().bytes()[0], ser::serialization_type_byte(ser::kMsgPack));
+  BOOST_CHECK_EQUAL(async.get_metrics().callback_failures, 1u);
+}
+
+BOOST_AUTO_TEST_CASE(BuffersAreReused)
+{
+  auto pool = std::make_shared<ser::BufferPool>(4);
+  const uint8_t* first_data = nullptr; // NOLINT(build/unsigned)
+  {
+    std::vector<uint8_t> v(100); // NOLINT(build/unsigned)
+    first_data = v.data();
+    ser::PooledBuffer buf(std::move(v), pool);
+  }
+  std::vector<uint8_t> v = pool->acquire(); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(v.size(), 0u);
+  BOOST_CHECK(v.data() == first_data);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
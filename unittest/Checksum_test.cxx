@@ -0,0 +1,139 @@
+/**
+ * @file Checksum_test.cxx Message checksum Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/Checksum.hpp"
+#include "serialization/Serialization.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE Checksum_test // NOLINT
+
+#include "boost/test/data/test_case.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include <numeric>
+#include <string>
+#include <vector>
+
+struct Reading
+{
+  int channel;
+  double value;
+  std::string name;
+  std::vector<int> samples;
+
+  DUNE_DAQ_SERIALIZE(Reading, channel, value, name, samples);
+};
+
+namespace ser = dunedaq::serialization;
+
+BOOST_AUTO_TEST_SUITE(Checksum_test)
+
+BOOST_AUTO_TEST_CASE(KnownValues)
+{
+  const std::string check = "123456789";
+  BOOST_CHECK_EQUAL(ser::crc32c(check.data(), check.size()), 0xe3069283);
+  BOOST_CHECK_EQUAL(ser::crc32c(nullptr, 0), 0u);
+
+  // Checksumming in pieces gives the same result as all at once
+  std::vector<uint8_t> data(1000); // NOLINT(build/unsigned)
+  std::iota(data.begin(), data.end(), 0);
+  uint32_t whole = ser::crc32c(data.data(), data.size()); // NOLINT(build/unsigned)
+  uint32_t part = ser::crc32c(data.data(), 123);          // NOLINT(build/unsigned)
+  part = ser::crc32c(data.data() + 123, data.size() - 123, part);
+  BOOST_CHECK_EQUAL(whole, part);
+
+  // The hardware and software paths agree, at every alignment and
+  // length. Calling the hardware path on a CPU without it would crash
+  if (!ser::detail::crc32c_hw_available()) {
+    BOOST_TEST_MESSAGE("No hardware CRC32C on this CPU, skipping the comparison with the software path");
+    return;
+  }
+  for (std::size_t off = 0; off < 8; ++off) {
+    for (std::size_t len = 0; len < 40; ++len) {
+      BOOST_CHECK_EQUAL(ser::detail::crc32c_sw(~0u, data.data() + off, len),
+                        ser::detail::crc32c_hw(~0u, data.data() + off, len));
+    }
+  }
+}
+
+BOOST_DATA_TEST_CASE(RoundTrip, boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON, ser::kMsgPackInterned }))
+{
+  Reading r{ 3, 1.5, "TPC", { 1, 2, 3 } };
+  std::vector<uint8_t> bytes = ser::serialize(r, sample, { ser::kCRC32C }); // NOLINT(build/unsigned)
+  BOOST_REQUIRE_GT(bytes.size(), ser::checksum_header_size);
+  BOOST_CHECK_EQUAL(bytes[0], ser::checksum_type_byte);
+  BOOST_CHECK_EQUAL(bytes[ser::checksum_header_size], ser::serialization_type_byte(sample));
+
+  // The checksum only adds the header
+  std::vector<uint8_t> plain = ser::serialize(r, sample); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(bytes.size(), plain.size() + ser::checksum_header_size);
+
+  Reading r_deserialized = ser::deserialize<Reading>(bytes);
+  BOOST_CHECK_EQUAL(r_deserialized.channel, r.channel);
+  BOOST_CHECK_EQUAL(r_deserialized.value, r.value);
+  BOOST_CHECK_EQUAL(r_deserialized.name, r.name);
+  BOOST_CHECK(r_deserialized.samples == r.samples);
+
+  auto result = ser::try_deserialize<Reading>(bytes);
+  BOOST_REQUIRE(result);
+  BOOST_CHECK_EQUAL(result->name, r.name);
+}
+
+BOOST_DATA_TEST_CASE(Corruption, boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON }))
+{
+  Reading r{ 3, 1.5, "TPC", { 1, 2, 3 } };
+  std::vector<uint8_t> bytes = ser::serialize(r, sample, { ser::kCRC32C }); // NOLINT(build/unsigned)
+
+  // Flip one bit in the payload: the message may well still parse, but
+  // the checksum catches it
+  std::vector<uint8_t> corrupted = bytes; // NOLINT(build/unsigned)
+  corrupted.back() ^= 0x1;
+  BOOST_CHECK_THROW(ser::deserialize<Reading>(corrupted), ser::ChecksumMismatch);
+  auto result = ser::try_deserialize<Reading>(corrupted);
+  BOOST_REQUIRE(!result);
+  BOOST_CHECK_EQUAL(result.error(), ser::kChecksumMismatch);
+
+  // Corrupting the checksum itself is caught too
+  corrupted = bytes;
+  corrupted[1] ^= 0x80;
+  BOOST_CHECK_THROW(ser::deserialize<Reading>(corrupted), ser::ChecksumMismatch);
+
+  // Verification can be skipped per call
+  ser::DeserializationOptions options;
+  options.verify_checksum = false;
+  Reading r_deserialized = ser::deserialize<Reading>(corrupted, options);
+  BOOST_CHECK_EQUAL(r_deserialized.name, r.name);
+  BOOST_CHECK(ser::try_deserialize<Reading>(corrupted, options));
+
+  // Too short to hold the header
+  std::vector<uint8_t> truncated(bytes.begin(), bytes.begin() + ser::checksum_header_size); // NOLINT(build/unsigned)
+  BOOST_CHECK_THROW(ser::deserialize<Reading>(truncated), ser::CannotDeserializeMessage);
+  result = ser::try_deserialize<Reading>(truncated);
+  BOOST_REQUIRE(!result);
+  BOOST_CHECK_EQUAL(result.error(), ser::kTruncated);
+}
+
+BOOST_AUTO_TEST_CASE(NestedChecksum)
+{
+  Reading r{ 3, 1.5, "TPC", { 1, 2, 3 } };
+  std::vector<uint8_t> inner = ser::serialize(r, ser::kJSON, { ser::kCRC32C }); // NOLINT(build/unsigned)
+
+  // A valid checksum around a checksummed message is still rejected
+  std::vector<uint8_t> bytes(ser::checksum_header_size); // NOLINT(build/unsigned)
+  bytes[0] = ser::checksum_type_byte;
+  ser::detail::write_le32(&bytes[1], ser::crc32c(inner.data(), inner.size()));
+  bytes.insert(bytes.end(), inner.begin(), inner.end());
+  BOOST_CHECK_THROW(ser::deserialize<Reading>(bytes), ser::CannotDeserializeMessage);
+  auto result = ser::try_deserialize<Reading>(bytes);
+  BOOST_REQUIRE(!result);
+  BOOST_CHECK_EQUAL(result.error(), ser::kMalformed);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,234 @@
+/**
+ * @file ChunkedBlob_test.cxx ChunkedBlob class Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/ChunkedBlob.hpp"
+#include "serialization/DeltaEncoding.hpp"
+#include "serialization/Serialization.hpp"
+#include "serialization/StringInterning.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE ChunkedBlob_test // NOLINT
+
+#include "boost/test/data/test_case.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include <sys/mman.h>
+
+#include <numeric>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct Record
+{
+  int run;
+  dunedaq::serialization::ChunkedBlob payload;
+
+  DUNE_DAQ_SERIALIZE(Record, run, payload);
+};
+
+// A record whose payload borrows even when deserialize<T>() constructs it
+struct BorrowingRecord
+{
+  int run = 0;
+  dunedaq::serialization::ChunkedBlob payload{ dunedaq::serialization::ChunkedBlob::kBorrowSegments };
+
+  DUNE_DAQ_SERIALIZE(BorrowingRecord, run, payload);
+};
+
+namespace ser = dunedaq::serialization;
+
+BOOST_AUTO_TEST_SUITE(ChunkedBlob_test)
+
+BOOST_AUTO_TEST_CASE(ViewSegments)
+{
+  std::vector<uint8_t> data(1000); // NOLINT(build/unsigned)
+  std::iota(data.begin(), data.end(), 0);
+
+  ser::ChunkedBlob blob = ser::ChunkedBlob::view(data.data(), data.size(), 300);
+  BOOST_REQUIRE_EQUAL(blob.segments().size(), 4u);
+  BOOST_CHECK_EQUAL(blob.size(), data.size());
+  // Views don't copy
+  BOOST_CHECK(blob.segments()[0].data == data.data());
+  BOOST_CHECK(blob.segments()[1].data == data.data() + 300);
+  BOOST_CHECK_EQUAL(blob.segments()[3].size, 100u);
+  BOOST_CHECK(blob.to_contiguous() == data);
+}
+
+BOOST_DATA_TEST_CASE(RoundTrip, boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON }))
+{
+  std::vector<uint8_t> data(10000); // NOLINT(build/unsigned)
+  std::iota(data.begin(), data.end(), 0);
+
+  Record r;
+  r.run = 42;
+  r.payload = ser::ChunkedBlob::view(data.data(), data.size(), 4096);
+
+  std::vector<uint8_t> bytes = ser::serialize(r, sample); // NOLINT(build/unsigned)
+  Record r_recv = ser::deserialize<Record>(bytes);
+  BOOST_CHECK_EQUAL(r_recv.run, r.run);
+  BOOST_REQUIRE_EQUAL(r_recv.payload.segments().size(), 3u);
+  BOOST_CHECK_EQUAL(r_recv.payload.segments()[2].size, 10000u - 2 * 4096u);
+  BOOST_CHECK(r_recv.payload.to_contiguous() == data);
+
+  // The deserialized blob owns its segments
+  bytes.clear();
+  bytes.shrink_to_fit();
+  ser::ChunkedBlob copy = r_recv.payload;
+  r_recv = Record();
+  BOOST_CHECK(copy.to_contiguous() == data);
+}
+
+BOOST_AUTO_TEST_CASE(PackedSize)
+{
+  std::vector<uint8_t> data(5000, 7); // NOLINT(build/unsigned)
+  Record r{ 1, ser::ChunkedBlob::view(data.data(), data.size(), 1000) };
+
+  size_t expected = ser::packed_size(r);
+  std::vector<uint8_t> bytes; // NOLINT(build/unsigned)
+  bytes.reserve(expected);
+  ser::serialize_into(r, ser::kMsgPack, bytes);
+  BOOST_CHECK_EQUAL(bytes.size(), expected);
+  BOOST_CHECK(bytes == ser::serialize(r, ser::kMsgPack));
+}
+
+BOOST_AUTO_TEST_CASE(UnpackLimits)
+{
+  std::vector<uint8_t> data(5000, 7); // NOLINT(build/unsigned)
+  Record r{ 1, ser::ChunkedBlob::view(data.data(), data.size(), 1000) };
+  std::vector<uint8_t> bytes = ser::serialize(r, ser::kMsgPack); // NOLINT(build/unsigned)
+
+  // Segments of 1000 bytes are fine if BIN fields may be up to 1000 bytes...
+  ser::DeserializationOptions options;
+  options.unpack_limit = msgpack::unpack_limit(0xffffffff, 0xffffffff, 0xffffffff, 1000);
+  BOOST_CHECK_EQUAL(ser::deserialize<Record>(bytes, options).payload.size(), data.size());
+
+  // ...but not if they may only be 999
+  options.unpack_limit = msgpack::unpack_limit(0xffffffff, 0xffffffff, 0xffffffff, 999);
+  BOOST_CHECK_THROW(ser::deserialize<Record>(bytes, options), ser::CannotDeserializeMessage);
+  auto result = ser::try_deserialize<Record>(bytes, options);
+  BOOST_REQUIRE(!result);
+  BOOST_CHECK_EQUAL(result.error(), ser::kLimitExceeded);
+}
+
+BOOST_AUTO_TEST_CASE(BorrowSegments)
+{
+  std::vector<uint8_t> data(10000); // NOLINT(build/unsigned)
+  std::iota(data.begin(), data.end(), 0);
+  Record r{ 42, ser::ChunkedBlob::view(data.data(), data.size(), 4096) };
+  std::vector<uint8_t> bytes = ser::serialize(r, ser::kMsgPack); // NOLINT(build/unsigned)
+
+  Record r_recv{ 0, ser::ChunkedBlob(ser::ChunkedBlob::kBorrowSegments) };
+  ser::deserialize_into(bytes, r_recv);
+  BOOST_CHECK_EQUAL(r_recv.run, 42);
+  BOOST_REQUIRE_EQUAL(r_recv.payload.segments().size(), 3u);
+  BOOST_CHECK(r_recv.payload.to_contiguous() == data);
+  // The segments point into the message
+  for (auto& seg : r_recv.payload.segments()) {
+    BOOST_CHECK(seg.data > bytes.data() && seg.data + seg.size <= bytes.data() + bytes.size());
+  }
+  BOOST_CHECK_EQUAL(r_recv.payload.decode_mode(), ser::ChunkedBlob::kBorrowSegments);
+
+  // Assigning to the blob replaces its segments, but it still borrows
+  for (ser::ChunkedBlob other : { ser::ChunkedBlob::view(data.data(), 10), ser::ChunkedBlob() }) {
+    r_recv.payload = other;
+    BOOST_CHECK_EQUAL(r_recv.payload.size(), other.size());
+    r_recv.payload = std::move(other);
+    BOOST_CHECK_EQUAL(r_recv.payload.decode_mode(), ser::ChunkedBlob::kBorrowSegments);
+    ser::deserialize_into(bytes, r_recv);
+    BOOST_REQUIRE_EQUAL(r_recv.payload.segments().size(), 3u);
+    BOOST_CHECK(r_recv.payload.segments()[0].data > bytes.data() &&
+                r_recv.payload.segments()[0].data < bytes.data() + bytes.size());
+  }
+
+  // deserialize<T>() only borrows if T's default constructor asks for it
+  Record r_copy = ser::deserialize<Record>(bytes);
+  BOOST_CHECK_EQUAL(r_copy.payload.decode_mode(), ser::ChunkedBlob::kCopySegments);
+  BorrowingRecord r_borrow = ser::deserialize<BorrowingRecord>(bytes);
+  BOOST_REQUIRE(!r_borrow.payload.empty());
+  BOOST_CHECK(r_borrow.payload.segments()[0].data > bytes.data() &&
+              r_borrow.payload.segments()[0].data < bytes.data() + bytes.size());
+}
+
+BOOST_AUTO_TEST_CASE(DecodersCopySegments)
+{
+  std::vector<uint8_t> data(10000); // NOLINT(build/unsigned)
+  std::iota(data.begin(), data.end(), 0);
+  BorrowingRecord r;
+  r.run = 42;
+  r.payload = ser::ChunkedBlob::view(data.data(), data.size(), 4096);
+
+  // Neither decoder may leave segments pointing into a frame, which
+  // the caller frees, or into the delta decoder's reused buffer
+  ser::StringInternEncoder intern_encoder;
+  ser::StringInternDecoder intern_decoder;
+  std::vector<uint8_t> frame = intern_encoder.encode(r); // NOLINT(build/unsigned)
+  BorrowingRecord from_intern = intern_decoder.decode<BorrowingRecord>(frame);
+  std::fill(frame.begin(), frame.end(), 0);
+  BOOST_CHECK(from_intern.payload.to_contiguous() == data);
+
+  ser::DeltaEncoder<BorrowingRecord> delta_encoder;
+  ser::DeltaDecoder<BorrowingRecord> delta_decoder;
+  BorrowingRecord from_delta = delta_decoder.decode(delta_encoder.encode(r));
+  r.run = 43;
+  r.payload = ser::ChunkedBlob::view(data.data(), 100);
+  BorrowingRecord next = delta_decoder.decode(delta_encoder.encode(r));
+  BOOST_CHECK_EQUAL(next.run, 43);
+  BOOST_CHECK_EQUAL(next.payload.size(), 100u);
+  BOOST_CHECK(from_delta.payload.to_contiguous() == data);
+}
+
+BOOST_AUTO_TEST_CASE(MovedFromIsEmpty)
+{
+  std::vector<uint8_t> data(100); // NOLINT(build/unsigned)
+  ser::ChunkedBlob blob(ser::ChunkedBlob::kBorrowSegments);
+  blob.append_view(data.data(), data.size());
+
+  ser::ChunkedBlob moved(std::move(blob));
+  BOOST_CHECK_EQUAL(moved.size(), data.size());
+  BOOST_CHECK_EQUAL(moved.decode_mode(), ser::ChunkedBlob::kBorrowSegments);
+  // NOLINTNEXTLINE(bugprone-use-after-move)
+  BOOST_CHECK(blob.empty());
+  BOOST_CHECK_EQUAL(blob.size(), 0u);
+  BOOST_CHECK(blob.segments().empty());
+  BOOST_CHECK_EQUAL(blob.decode_mode(), ser::ChunkedBlob::kBorrowSegments);
+
+  ser::ChunkedBlob assigned;
+  assigned = std::move(moved);
+  BOOST_CHECK_EQUAL(assigned.size(), data.size());
+  // NOLINTNEXTLINE(bugprone-use-after-move)
+  BOOST_CHECK(moved.empty());
+  BOOST_CHECK(moved.segments().empty());
+}
+
+BOOST_AUTO_TEST_CASE(SplitOversizedSegments)
+{
+  if (sizeof(std::size_t) < 8)
+    return;
+
+  // Only the pointers are recorded, so reserve address space for the
+  // payload without committing any memory to it
+  const std::size_t size = 2 * ser::ChunkedBlob::max_segment_size + 10;
+  void* mem = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  BOOST_REQUIRE(mem != MAP_FAILED);
+  const uint8_t* base = static_cast<const uint8_t*>(mem); // NOLINT(build/unsigned)
+
+  ser::ChunkedBlob blob;
+  blob.append_view(base, size);
+  BOOST_REQUIRE_EQUAL(blob.segments().size(), 3u);
+  BOOST_CHECK_EQUAL(blob.size(), size);
+  BOOST_CHECK_EQUAL(blob.segments()[0].size, ser::ChunkedBlob::max_segment_size);
+  BOOST_CHECK(blob.segments()[1].data == base + ser::ChunkedBlob::max_segment_size);
+  BOOST_CHECK(blob.segments()[2].data == base + 2 * ser::ChunkedBlob::max_segment_size);
+  BOOST_CHECK_EQUAL(blob.segments()[2].size, 10u);
+  munmap(mem, size);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,272 @@
+/**
+ * @file Compression_test.cxx Compressed message Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/Serialization.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE Compression_test // NOLINT
+
+#include "boost/test/data/monomorphic.hpp"
+#include "boost/test/data/test_case.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+struct Readout
+{
+  std::string source;
+  std::vector<int> adcs;
+  std::vector<uint8_t> raw; // NOLINT(build/unsigned)
+
+  DUNE_DAQ_SERIALIZE(Readout, source, adcs, raw);
+};
+
+namespace ser = dunedaq::serialization;
+
+// A readout that compresses well: slowly varying ADCs, mostly empty raw data
+Readout
+make_readout(std::size_t n)
+{
+  Readout r;
+  r.source = "detector_readout_crate_1_link_3";
+  for (std::size_t i = 0; i < n; ++i)
+    r.adcs.push_back(900 + static_cast<int>(i % 16));
+  r.raw.assign(n, 0);
+  r.raw[n / 2] = 42;
+  return r;
+}
+
+bool
+codec_available(ser::CompressionMode mode)
+{
+  return mode == ser::kLZ4 ? ser::detail::Lz4Codec::available : ser::detail::ZstdCodec::available;
+}
+
+uint8_t // NOLINT(build/unsigned)
+codec_type_byte(ser::CompressionMode mode)
+{
+  return mode == ser::kLZ4 ? ser::lz4_type_byte : ser::zstd_type_byte;
+}
+
+// Compress @p inner as it is, whatever it holds
+std::vector<uint8_t>                                            // NOLINT(build/unsigned)
+compress_raw(ser::CompressionMode mode, const std::vector<uint8_t>& inner) // NOLINT(build/unsigned)
+{
+  std::size_t bound = mode == ser::kLZ4 ? ser::detail::Lz4Codec::bound(inner.size())
+                                        : ser::detail::ZstdCodec::bound(inner.size());
+  std::vector<uint8_t> bytes(ser::compression_header_size + bound); // NOLINT(build/unsigned)
+  bytes[0] = codec_type_byte(mode);
+  ser::detail::write_le64(&bytes[1], inner.size());
+  uint8_t* dst = &bytes[ser::compression_header_size]; // NOLINT(build/unsigned)
+  std::size_t n = mode == ser::kLZ4 ? ser::detail::Lz4Codec::compress(inner.data(), inner.size(), dst, bound, 0)
+                                    : ser::detail::ZstdCodec::compress(inner.data(), inner.size(), dst, bound, 0);
+  bytes.resize(ser::compression_header_size + n);
+  return bytes;
+}
+
+void
+check_equal(const Readout& a, const Readout& b)
+{
+  BOOST_CHECK_EQUAL(a.source, b.source);
+  BOOST_CHECK(a.adcs == b.adcs);
+  BOOST_CHECK(a.raw == b.raw);
+}
+
+BOOST_AUTO_TEST_SUITE(Compression_test)
+
+auto compression_modes = boost::unit_test::data::make({ ser::kLZ4, ser::kZstd });
+auto stypes = boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON, ser::kMsgPackInterned });
+
+BOOST_DATA_TEST_CASE(RoundTrip, compression_modes * stypes, mode, stype)
+{
+  Readout r = make_readout(10000);
+  ser::SerializationOptions options;
+  options.compression = mode;
+
+  if (!codec_available(mode)) {
+    BOOST_CHECK_THROW(ser::serialize(r, stype, options), ser::CompressionUnavailable);
+    return;
+  }
+
+  std::vector<uint8_t> plain = ser::serialize(r, stype);               // NOLINT(build/unsigned)
+  std::vector<uint8_t> compressed = ser::serialize(r, stype, options); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(compressed.at(0), codec_type_byte(mode));
+  BOOST_CHECK_LT(compressed.size(), plain.size() / 4);
+  BOOST_CHECK_EQUAL(ser::detail::read_le64(&compressed[1]), plain.size());
+
+  check_equal(ser::deserialize<Readout>(compressed), r);
+  auto result = ser::try_deserialize<Readout>(compressed);
+  BOOST_REQUIRE(result);
+  check_equal(*result, r);
+
+  // Other levels produce messages that decode the same way
+  for (int level : { -5, 1, 9 }) {
+    options.compression_level = level;
+    check_equal(ser::deserialize<Readout>(ser::serialize(r, stype, options)), r);
+  }
+}
+
+BOOST_DATA_TEST_CASE(Threshold, compression_modes, mode)
+{
+  Readout r = make_readout(100);
+  ser::SerializationOptions options;
+  options.compression = mode;
+
+  // Asking for a codec this build doesn't have is an error, even for
+  // a message too small to be compressed
+  if (!codec_available(mode)) {
+    BOOST_CHECK_THROW(ser::serialize(r, ser::kMsgPack, options), ser::CompressionUnavailable);
+    return;
+  }
+
+  // Below the threshold, the message isn't compressed
+  std::vector<uint8_t> bytes = ser::serialize(r, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  BOOST_REQUIRE_LT(bytes.size(), options.compression_threshold);
+  BOOST_CHECK(bytes == ser::serialize(r, ser::kMsgPack));
+
+  options.compression_threshold = 0;
+  bytes = ser::serialize(r, ser::kMsgPack, options);
+  BOOST_CHECK_EQUAL(bytes.at(0), codec_type_byte(mode));
+  check_equal(ser::deserialize<Readout>(bytes), r);
+}
+
+BOOST_DATA_TEST_CASE(Incompressible, compression_modes, mode)
+{
+  Readout r;
+  std::mt19937 rng(1234);
+  for (int i = 0; i < 100000; ++i)
+    r.raw.push_back(static_cast<uint8_t>(rng())); // NOLINT(build/unsigned)
+
+  ser::SerializationOptions options;
+  options.compression = mode;
+  if (!codec_available(mode)) {
+    std::vector<uint8_t> bytes; // NOLINT(build/unsigned)
+    BOOST_CHECK_THROW(ser::serialize_into(r, ser::kMsgPack, bytes, options), ser::CompressionUnavailable);
+    return;
+  }
+  // Compression doesn't help, so the message is sent as it is. Reuse
+  // the buffer, to check that it doesn't matter what was in it before
+  std::vector<uint8_t> bytes = ser::serialize(make_readout(10000), ser::kMsgPack, options); // NOLINT(build/unsigned)
+  ser::serialize_into(r, ser::kMsgPack, bytes, options);
+  BOOST_CHECK(bytes == ser::serialize(r, ser::kMsgPack));
+}
+
+BOOST_DATA_TEST_CASE(WithChecksum, compression_modes, mode)
+{
+  Readout r = make_readout(10000);
+  ser::SerializationOptions options;
+  options.compression = mode;
+  options.checksum = ser::kCRC32C;
+
+  if (!codec_available(mode)) {
+    BOOST_CHECK_THROW(ser::serialize(r, ser::kMsgPack, options), ser::CompressionUnavailable);
+    return;
+  }
+
+  // The checksum covers the compressed message
+  std::vector<uint8_t> bytes = ser::serialize(r, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(bytes.at(0), ser::checksum_type_byte);
+  BOOST_CHECK_EQUAL(bytes.at(ser::checksum_header_size), codec_type_byte(mode));
+  BOOST_CHECK_EQUAL(ser::detail::read_le32(&bytes[1]),
+                    ser::crc32c(bytes.data() + ser::checksum_header_size, bytes.size() - ser::checksum_header_size));
+  check_equal(ser::deserialize<Readout>(bytes), r);
+
+  bytes.back() ^= 0x1;
+  BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::ChecksumMismatch);
+}
+
+BOOST_DATA_TEST_CASE(Corrupt, compression_modes, mode)
+{
+  // A compressed message can't be read without the codec. Without
+  // it, compress_raw() writes just the header
+  if (!codec_available(mode)) {
+    std::vector<uint8_t> bytes = compress_raw(mode, ser::serialize(make_readout(10000), ser::kMsgPack)); // NOLINT
+    BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::CompressionUnavailable);
+    BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(bytes).error(), ser::kCompressionError);
+    return;
+  }
+
+  ser::SerializationOptions options;
+  options.compression = mode;
+  const std::vector<uint8_t> good = // NOLINT(build/unsigned)
+    ser::serialize(make_readout(10000), ser::kMsgPack, options);
+
+  // Damaged compressed data
+  std::vector<uint8_t> bytes = good; // NOLINT(build/unsigned)
+  for (std::size_t i = ser::compression_header_size + 8; i < bytes.size(); i += 7)
+    bytes[i] ^= 0x5a;
+  BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::CannotDeserializeMessage);
+  BOOST_CHECK(!ser::try_deserialize<Readout>(bytes));
+
+  // Wrong uncompressed size
+  bytes = good;
+  ser::detail::write_le64(&bytes[1], ser::detail::read_le64(&bytes[1]) + 1);
+  BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(bytes).error(), ser::kCompressionError);
+
+  // A huge claimed size is rejected before anything is allocated,
+  // by the default limit or, without one, as implausible
+  bytes = good;
+  ser::detail::write_le64(&bytes[1], uint64_t(1) << 60); // NOLINT(build/unsigned)
+  BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(bytes).error(), ser::kLimitExceeded);
+  ser::DeserializationOptions unlimited;
+  unlimited.max_decompressed_size = SIZE_MAX;
+  BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(bytes, unlimited).error(), ser::kCompressionError);
+
+  // Header only
+  bytes.assign(good.begin(), good.begin() + ser::compression_header_size);
+  BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(bytes).error(), ser::kTruncated);
+
+  // Larger than the caller allows
+  ser::DeserializationOptions limits;
+  limits.max_decompressed_size = 1000;
+  BOOST_CHECK_THROW(ser::deserialize<Readout>(good, limits), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(good, limits).error(), ser::kLimitExceeded);
+}
+
+BOOST_DATA_TEST_CASE(Nested, compression_modes, mode)
+{
+  Readout r = make_readout(10000);
+  ser::SerializationOptions options;
+  options.compression = mode;
+
+  // Without the codec, a checksummed compressed message fails on the
+  // codec, once the checksum has been verified
+  if (!codec_available(mode)) {
+    std::vector<uint8_t> bytes = compress_raw(mode, ser::serialize(r, ser::kMsgPack)); // NOLINT(build/unsigned)
+    std::vector<uint8_t> checksummed(ser::checksum_header_size); // NOLINT(build/unsigned)
+    checksummed[0] = ser::checksum_type_byte;
+    ser::detail::write_le32(&checksummed[1], ser::crc32c(bytes.data(), bytes.size()));
+    checksummed.insert(checksummed.end(), bytes.begin(), bytes.end());
+    BOOST_CHECK_THROW(ser::deserialize<Readout>(checksummed), ser::CompressionUnavailable);
+    BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(checksummed).error(), ser::kCompressionError);
+    return;
+  }
+
+  // A plain message compressed by hand decodes like any other...
+  check_equal(ser::deserialize<Readout>(compress_raw(mode, ser::serialize(r, ser::kMsgPack))), r);
+
+  // ...but serialize() never puts a compressed or checksummed message
+  // inside a compressed one, so those are rejected
+  std::vector<uint8_t> compressed = ser::serialize(r, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  options.checksum = ser::kCRC32C;
+  std::vector<uint8_t> checksummed = ser::serialize(r, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  for (auto& inner : { compressed, checksummed }) {
+    std::vector<uint8_t> bytes = compress_raw(mode, inner); // NOLINT(build/unsigned)
+    BOOST_CHECK_THROW(ser::deserialize<Readout>(bytes), ser::CannotDeserializeMessage);
+    BOOST_CHECK_EQUAL(ser::try_deserialize<Readout>(bytes).error(), ser::kMalformed);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,194 @@
+/**
+ * @file DeltaEncoding_test.cxx DeltaEncoder/DeltaDecoder Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/DeltaEncoding.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE DeltaEncoding_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+struct StatusMessage
+{
+  int count;
+  std::string source;
+  std::vector<double> values;
+  double rate;
+
+  DUNE_DAQ_SERIALIZE(StatusMessage, count, source, values, rate);
+};
+
+// Same shape as StatusMessage, but its first field can't be read as an int
+struct TextStatusMessage
+{
+  std::string count;
+  std::string source;
+  std::vector<double> values;
+  double rate;
+
+  DUNE_DAQ_SERIALIZE(TextStatusMessage, count, source, values, rate);
+};
+
+namespace ser = dunedaq::serialization;
+
+namespace {
+StatusMessage
+make_status(int count)
+{
+  return StatusMessage{ count, "a_rather_long_source_name", std::vector<double>(50, 1.5), 10.0 };
+}
+
+void
+check_equal(const StatusMessage& a, const StatusMessage& b)
+{
+  BOOST_CHECK_EQUAL(a.count, b.count);
+  BOOST_CHECK_EQUAL(a.source, b.source);
+  BOOST_CHECK_EQUAL_COLLECTIONS(a.values.begin(), a.values.end(), b.values.begin(), b.values.end());
+  BOOST_CHECK_EQUAL(a.rate, b.rate);
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(DeltaEncoding_test)
+
+BOOST_AUTO_TEST_CASE(RoundTrip)
+{
+  ser::DeltaEncoder<StatusMessage> encoder;
+  ser::DeltaDecoder<StatusMessage> decoder;
+
+  StatusMessage m = make_status(0);
+  std::vector<uint8_t> keyframe = encoder.encode(m); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(keyframe[0], ser::delta_frame_byte);
+  check_equal(decoder.decode(keyframe), m);
+
+  for (int i = 1; i < 10; ++i) {
+    m.count = i;
+    if (i % 3 == 0)
+      m.rate = i;
+    std::vector<uint8_t> delta = encoder.encode(m); // NOLINT(build/unsigned)
+    // Only one or two fields changed, so the frame should be much
+    // smaller than the keyframe
+    BOOST_CHECK_LT(delta.size(), keyframe.size() / 2);
+    check_equal(decoder.decode(delta), m);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(UnchangedMessage)
+{
+  ser::DeltaEncoder<StatusMessage> encoder;
+  ser::DeltaDecoder<StatusMessage> decoder;
+  StatusMessage m = make_status(1);
+  decoder.decode(encoder.encode(m));
+  check_equal(decoder.decode(encoder.encode(m)), m);
+
+  // Frames in a std::pmr::vector decode the same way
+  std::vector<uint8_t> frame = encoder.encode(m);                  // NOLINT(build/unsigned)
+  std::pmr::vector<uint8_t> pmr_frame(frame.begin(), frame.end()); // NOLINT(build/unsigned)
+  check_equal(decoder.decode(pmr_frame), m);
+}
+
+BOOST_AUTO_TEST_CASE(PeriodicKeyframes)
+{
+  ser::DeltaEncoder<StatusMessage> encoder(4);
+  StatusMessage m = make_status(0);
+  std::vector<size_t> sizes;
+  for (int i = 0; i < 9; ++i) {
+    m.count = i;
+    sizes.push_back(encoder.encode(m).size());
+  }
+  // Frames 0, 4 and 8 are keyframes
+  BOOST_CHECK_EQUAL(sizes[0], sizes[4]);
+  BOOST_CHECK_EQUAL(sizes[0], sizes[8]);
+  BOOST_CHECK_LT(sizes[1], sizes[0]);
+  BOOST_CHECK_LT(sizes[5], sizes[4]);
+
+  encoder.request_keyframe();
+  BOOST_CHECK_EQUAL(encoder.encode(m).size(), sizes[0]);
+}
+
+BOOST_AUTO_TEST_CASE(SequenceGap)
+{
+  ser::DeltaEncoder<StatusMessage> encoder;
+  ser::DeltaDecoder<StatusMessage> decoder;
+  StatusMessage m = make_status(0);
+
+  // A delta frame can't be decoded before the first keyframe
+  std::vector<uint8_t> first = encoder.encode(m); // NOLINT(build/unsigned)
+  m.count = 1;
+  std::vector<uint8_t> second = encoder.encode(m); // NOLINT(build/unsigned)
+  BOOST_CHECK_THROW(decoder.decode(second), ser::DeltaKeyframeRequired);
+  decoder.decode(first);
+  BOOST_CHECK(decoder.synchronized());
+
+  // Drop a frame
+  m.count = 2;
+  encoder.encode(m);
+  m.count = 3;
+  BOOST_CHECK_THROW(decoder.decode(encoder.encode(m)), ser::DeltaSequenceGap);
+  BOOST_CHECK(!decoder.synchronized());
+  m.count = 4;
+  BOOST_CHECK_THROW(decoder.decode(encoder.encode(m)), ser::DeltaKeyframeRequired);
+
+  // A keyframe resynchronizes the stream
+  encoder.request_keyframe();
+  m.count = 5;
+  check_equal(decoder.decode(encoder.encode(m)), m);
+  m.count = 6;
+  check_equal(decoder.decode(encoder.encode(m)), m);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidFrames)
+{
+  ser::DeltaDecoder<StatusMessage> decoder;
+  std::vector<uint8_t> not_delta = ser::serialize(make_status(0), ser::kMsgPack); // NOLINT(build/unsigned)
+  BOOST_CHECK_THROW(decoder.decode(not_delta), ser::UnknownSerializationTypeByte);
+
+  ser::DeltaEncoder<StatusMessage> encoder;
+  std::vector<uint8_t> truncated = encoder.encode(make_status(0)); // NOLINT(build/unsigned)
+  truncated.resize(truncated.size() - 3);
+  BOOST_CHECK_THROW(decoder.decode(truncated), ser::CannotDeserializeMessage);
+  BOOST_CHECK(!decoder.synchronized());
+
+  ser::DeltaEncoder<int> int_encoder;
+  BOOST_CHECK_THROW(int_encoder.encode(3), ser::CannotDeltaEncode);
+
+  // A keyframe claiming 0xfffffff9 fields, with an empty bitmap
+  std::vector<uint8_t> huge = { ser::delta_frame_byte, 0x95, 0x00, 0xc3, 0xc2, // NOLINT(build/unsigned)
+                                0xce, 0xff, 0xff, 0xff, 0xf9, 0xc4, 0x00 };
+  BOOST_CHECK_THROW(decoder.decode(huge), ser::CannotDeserializeMessage);
+  BOOST_CHECK(!decoder.synchronized());
+}
+
+BOOST_AUTO_TEST_CASE(WrongTypeLeavesStateUnchanged)
+{
+  ser::DeltaEncoder<StatusMessage> encoder;
+  ser::DeltaEncoder<TextStatusMessage> text_encoder;
+  ser::DeltaDecoder<StatusMessage> decoder;
+
+  StatusMessage m = make_status(0);
+  decoder.decode(encoder.encode(m));
+  TextStatusMessage t{ "zero", m.source, m.values, m.rate };
+  text_encoder.encode(t);
+
+  // A well-formed delta frame with the right sequence number, whose
+  // one changed field has the wrong type
+  t.count = "one";
+  BOOST_CHECK_THROW(decoder.decode(text_encoder.encode(t)), ser::CannotDeserializeMessage);
+  BOOST_CHECK(decoder.synchronized());
+
+  // The decoder still expects the frame that follows the keyframe
+  m.count = 1;
+  check_equal(decoder.decode(encoder.encode(m)), m);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
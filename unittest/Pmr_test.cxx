@@ -0,0 +1,161 @@
+/**
+ * @file Pmr_test.cxx Serialization with std::pmr allocators Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/Serialization.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE Pmr_test // NOLINT
+
+#include "boost/test/data/test_case.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+// A memory resource that counts the bytes allocated through it
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+  std::size_t allocated = 0;
+
+private:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    allocated += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+  {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+struct Event
+{
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+  int run = 0;
+  std::pmr::string source;
+  std::pmr::vector<int> adcs;
+  std::pmr::vector<std::pmr::string> tags;
+
+  Event() = default;
+  explicit Event(const allocator_type& alloc)
+    : source(alloc)
+    , adcs(alloc)
+    , tags(alloc)
+  {}
+
+  DUNE_DAQ_SERIALIZE(Event, run, source, adcs, tags);
+};
+
+namespace ser = dunedaq::serialization;
+
+Event
+make_event()
+{
+  Event e;
+  e.run = 12;
+  e.source = "a source name longer than the small string buffer";
+  e.adcs = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  e.tags = { "first tag, also longer than the small string buffer", "second" };
+  return e;
+}
+
+BOOST_AUTO_TEST_SUITE(Pmr_test)
+
+BOOST_DATA_TEST_CASE(SerializeToResource, boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON }))
+{
+  Event e = make_event();
+  CountingResource upstream;
+  std::pmr::monotonic_buffer_resource arena(&upstream);
+
+  std::pmr::vector<uint8_t> bytes = ser::serialize_pmr(e, sample, &arena); // NOLINT(build/unsigned)
+  BOOST_CHECK(bytes.get_allocator().resource() == &arena);
+  BOOST_CHECK_GT(upstream.allocated, 0u);
+
+  std::vector<uint8_t> plain = ser::serialize(e, sample); // NOLINT(build/unsigned)
+  BOOST_CHECK(std::vector<uint8_t>(bytes.begin(), bytes.end()) == plain); // NOLINT(build/unsigned)
+
+  // Empty braces are default options, not a null resource
+  std::vector<uint8_t> braced = ser::serialize(e, sample, {}); // NOLINT(build/unsigned)
+  BOOST_CHECK(braced == plain);
+  BOOST_CHECK_EQUAL(ser::deserialize<Event>(braced, {}).source, e.source);
+
+  // A pmr vector can be deserialized directly
+  Event e_deserialized = ser::deserialize<Event>(bytes);
+  BOOST_CHECK_EQUAL(e_deserialized.source, e.source);
+  BOOST_CHECK(ser::try_deserialize<Event>(bytes));
+}
+
+BOOST_DATA_TEST_CASE(DeserializeToResource, boost::unit_test::data::make({ ser::kMsgPack, ser::kJSON }))
+{
+  Event e = make_event();
+  std::vector<uint8_t> bytes = ser::serialize(e, sample); // NOLINT(build/unsigned)
+
+  CountingResource resource;
+  Event e_deserialized = ser::deserialize_pmr<Event>(bytes, &resource);
+  BOOST_CHECK(e_deserialized.source.get_allocator().resource() == &resource);
+  BOOST_CHECK(e_deserialized.adcs.get_allocator().resource() == &resource);
+  BOOST_REQUIRE_EQUAL(e_deserialized.tags.size(), e.tags.size());
+  BOOST_CHECK(e_deserialized.tags[0].get_allocator().resource() == &resource);
+  BOOST_CHECK_GE(resource.allocated, e.source.size() + e.tags[0].size() + e.adcs.size() * sizeof(int));
+
+  BOOST_CHECK_EQUAL(e_deserialized.run, e.run);
+  BOOST_CHECK_EQUAL(e_deserialized.source, e.source);
+  BOOST_CHECK(e_deserialized.adcs == e.adcs);
+  BOOST_CHECK(e_deserialized.tags == e.tags);
+
+  // pmr containers on their own
+  std::vector<uint8_t> tag_bytes = ser::serialize(e.tags, sample); // NOLINT(build/unsigned)
+  auto tags = ser::deserialize_pmr<std::pmr::vector<std::pmr::string>>(tag_bytes, &resource);
+  BOOST_CHECK(tags.get_allocator().resource() == &resource);
+  BOOST_CHECK(tags == e.tags);
+}
+
+BOOST_AUTO_TEST_CASE(DeserializeInto)
+{
+  Event e = make_event();
+  std::vector<uint8_t> bytes = ser::serialize(e, ser::kMsgPack); // NOLINT(build/unsigned)
+
+  std::pmr::monotonic_buffer_resource arena;
+  Event e_deserialized{ Event::allocator_type(&arena) };
+  // Decoding twice into the same object reuses its members' capacity
+  for (int i = 0; i < 2; ++i) {
+    ser::deserialize_into(bytes, e_deserialized);
+    BOOST_CHECK_EQUAL(e_deserialized.source, e.source);
+    BOOST_CHECK(e_deserialized.tags == e.tags);
+    BOOST_CHECK(e_deserialized.tags[1].get_allocator().resource() == &arena);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(ReuseZone)
+{
+  msgpack::zone zone;
+  ser::DeserializationOptions options;
+  options.zone = &zone;
+
+  for (int i = 0; i < 10; ++i) {
+    Event e = make_event();
+    e.run = i;
+    std::vector<uint8_t> bytes = ser::serialize(e, ser::kMsgPack); // NOLINT(build/unsigned)
+    Event e_deserialized = ser::deserialize<Event>(bytes, options);
+    BOOST_CHECK_EQUAL(e_deserialized.run, i);
+    BOOST_CHECK(e_deserialized.adcs == e.adcs);
+    auto result = ser::try_deserialize<Event>(bytes, options);
+    BOOST_REQUIRE(result);
+    BOOST_CHECK_EQUAL(result->run, i);
+    zone.clear();
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
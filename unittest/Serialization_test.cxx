@@ -43,13 +43,63 @@ struct MyTypeNonIntrusive
 
 DUNE_DAQ_SERIALIZE_NON_INTRUSIVE(test, MyTypeNonIntrusive, a_float, values)
 
+namespace test {
+// A type without a default constructor, made serializable as described
+// in the msgpack and nlohmann::json documentation
+class Channel
+{
+public:
+  explicit Channel(int number)
+    : m_number(number)
+  {}
+  int number() const { return m_number; }
+
+private:
+  int m_number;
+};
+} // namespace test
+
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+{
+  namespace adaptor {
+  template<>
+  struct as<test::Channel>
+  {
+    test::Channel operator()(const msgpack::object& o) const { return test::Channel(o.as<int>()); }
+  };
+
+  template<>
+  struct pack<test::Channel>
+  {
+    template<typename Stream>
+    msgpack::packer<Stream>& operator()(msgpack::packer<Stream>& o, const test::Channel& c) const
+    {
+      return o.pack(c.number());
+    }
+  };
+  } // namespace adaptor
+} // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+} // namespace msgpack
+
+namespace nlohmann {
+template<>
+struct adl_serializer<test::Channel>
+{
+  static test::Channel from_json(const json& j) { return test::Channel(j.get<int>()); }
+  static void to_json(json& j, const test::Channel& c) { j = c.number(); }
+};
+} // namespace nlohmann
+
 BOOST_AUTO_TEST_SUITE(Serialization_test)
 
 /**
  * @brief Check that we can serialize -> deserialize and get back what we started with
  */
 BOOST_DATA_TEST_CASE(SerializationRoundTrip,
-                     boost::unit_test::data::make({ dunedaq::serialization::kMsgPack, dunedaq::serialization::kJSON }))
+                     boost::unit_test::data::make({ dunedaq::serialization::kMsgPack,
+                                                    dunedaq::serialization::kJSON,
+                                                    dunedaq::serialization::kMsgPackInterned }))
 {
 
   MyTypeIntrusive m;
@@ -68,7 +118,9 @@ BOOST_DATA_TEST_CASE(SerializationRoundTrip,
 }
 
 BOOST_DATA_TEST_CASE(SerializeVariant,
-                     boost::unit_test::data::make({ dunedaq::serialization::kMsgPack, dunedaq::serialization::kJSON }))
+                     boost::unit_test::data::make({ dunedaq::serialization::kMsgPack,
+                                                    dunedaq::serialization::kJSON,
+                                                    dunedaq::serialization::kMsgPackInterned }))
 {
   MyTypeIntrusive m;
   m.count = 3;
@@ -112,6 +164,21 @@ BOOST_DATA_TEST_CASE(SerializeVariant,
   }
 }
 
+BOOST_DATA_TEST_CASE(NonDefaultConstructible,
+                     boost::unit_test::data::make({ dunedaq::serialization::kMsgPack,
+                                                    dunedaq::serialization::kJSON,
+                                                    dunedaq::serialization::kMsgPackInterned }))
+{
+  namespace ser = dunedaq::serialization;
+
+  std::vector<uint8_t> bytes = ser::serialize(test::Channel(7), sample); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(ser::deserialize<test::Channel>(bytes).number(), 7);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<test::Channel>(bytes).value().number(), 7);
+
+  bytes = ser::serialize(test::Channel(8), sample, { ser::kCRC32C });
+  BOOST_CHECK_EQUAL(ser::deserialize<test::Channel>(bytes).number(), 8);
+}
+
 BOOST_AUTO_TEST_CASE(InvalidSerializationTypes)
 {
   BOOST_CHECK_THROW(dunedaq::serialization::from_string("not a real type"),
@@ -136,4 +203,108 @@ BOOST_AUTO_TEST_CASE(InvalidSerializationTypes)
                     dunedaq::serialization::CannotDeserializeMessage);
 }
 
+BOOST_DATA_TEST_CASE(TryDeserializeRoundTrip,
+                     boost::unit_test::data::make({ dunedaq::serialization::kMsgPack,
+                                                    dunedaq::serialization::kJSON,
+                                                    dunedaq::serialization::kMsgPackInterned }))
+{
+  MyTypeIntrusive m;
+  m.count = 3;
+  m.name = "foo";
+  m.values.push_back(3.1416);
+
+  namespace ser = dunedaq::serialization;
+
+  std::vector<uint8_t> bytes = ser::serialize(m, sample); // NOLINT(build/unsigned)
+  ser::DeserializationResult<MyTypeIntrusive> result = ser::try_deserialize<MyTypeIntrusive>(bytes);
+  BOOST_REQUIRE(result.has_value());
+  BOOST_CHECK_EQUAL(result->count, m.count);
+  BOOST_CHECK_EQUAL(result->name, m.name);
+  BOOST_CHECK_EQUAL_COLLECTIONS(result->values.begin(), result->values.end(), m.values.begin(), m.values.end());
+
+  // A well-formed message holding the wrong type
+  std::vector<uint8_t> string_bytes = ser::serialize(std::string("not a MyTypeIntrusive"), sample); // NOLINT
+  ser::DeserializationResult<MyTypeIntrusive> mismatch = ser::try_deserialize<MyTypeIntrusive>(string_bytes);
+  BOOST_REQUIRE(!mismatch);
+  BOOST_CHECK_EQUAL(mismatch.error(), ser::kTypeMismatch);
+  BOOST_CHECK_THROW(mismatch.value(), ser::CannotDeserializeMessage);
+}
+
+BOOST_AUTO_TEST_CASE(TryDeserializeErrors)
+{
+  namespace ser = dunedaq::serialization;
+
+  auto error_of = [](const std::vector<unsigned char>& v) {
+    auto result = ser::try_deserialize<int>(v);
+    BOOST_REQUIRE(!result.has_value());
+    return result.error();
+  };
+
+  BOOST_CHECK_EQUAL(error_of({}), ser::kTruncated);
+  BOOST_CHECK_EQUAL(error_of({ '0', '2', '3', '4' }), ser::kBadFormatByte);
+  BOOST_CHECK_EQUAL(error_of({ 'J', ']', '[', '4' }), ser::kMalformed);
+  // 0xce introduces a four-byte integer, but only two bytes follow
+  BOOST_CHECK_EQUAL(error_of({ 'M', 0xce, 0x0, 0x0 }), ser::kTruncated);
+  BOOST_CHECK_EQUAL(error_of({ 'M' }), ser::kTruncated);
+  // 0xc1 is never used in MsgPack
+  BOOST_CHECK_EQUAL(error_of({ 'M', 0xc1 }), ser::kMalformed);
+  // A reference to a string that was never defined
+  std::vector<unsigned char> bad_reference = { 'I', 0xd4, 0x7e, 0x00 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<std::string>(bad_reference).error(), ser::kMalformed);
+  // A well-formed message holding a string isn't an int
+  BOOST_CHECK_EQUAL(error_of({ 'M', 0xa3, 'a', 'b', 'c' }), ser::kTypeMismatch);
+
+  std::vector<unsigned char> good = { 'M', 0x05 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<int>(good).value(), 5);
+
+  // A positive fixint followed by a stray byte. Both functions ignore
+  // the stray byte, as msgpack does, unless asked not to
+  std::vector<unsigned char> trailing = { 'M', 0x01, 0x02 };
+  BOOST_CHECK_EQUAL(ser::deserialize<int>(trailing), 1);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<int>(trailing).value(), 1);
+  ser::DeserializationOptions strict;
+  strict.reject_trailing_bytes = true;
+  BOOST_CHECK_THROW(ser::deserialize<int>(trailing, strict), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<int>(trailing, strict).error(), ser::kSizeMismatch);
+
+  // Limits are enforced without msgpack throwing: an array of two
+  // elements, and an array nested two deep
+  ser::DeserializationOptions options;
+  options.unpack_limit = msgpack::unpack_limit(1, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 2);
+  std::vector<unsigned char> long_array = { 'M', 0x92, 0x01, 0x02 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<std::vector<int>>(long_array, options).error(), ser::kLimitExceeded);
+  std::vector<unsigned char> nested = { 'M', 0x91, 0x91, 0x91, 0x01 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<std::vector<int>>(nested, options).error(), ser::kLimitExceeded);
+  nested = { 'M', 0x91, 0x91, 0x01 };
+  BOOST_CHECK(ser::try_deserialize<std::vector<std::vector<int>>>(nested, options));
+}
+
+BOOST_AUTO_TEST_CASE(TryDeserializeRecordShape)
+{
+  namespace ser = dunedaq::serialization;
+
+  // MyTypeIntrusive is an array of an integer, a string and an array
+  std::vector<unsigned char> good = { 'M', 0x93, 0x03, 0xa3, 'f', 'o', 'o', 0x91, 0x01 };
+  auto result = ser::try_deserialize<MyTypeIntrusive>(good);
+  BOOST_REQUIRE(result);
+  BOOST_CHECK_EQUAL(result->name, "foo");
+  BOOST_CHECK_EQUAL(ser::deserialize<MyTypeIntrusive>(good).name, "foo");
+
+  // A misrouted message: the fields are in the wrong order
+  std::vector<unsigned char> misrouted = { 'M', 0x93, 0xa3, 'f', 'o', 'o', 0x03, 0x91, 0x01 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<MyTypeIntrusive>(misrouted).error(), ser::kTypeMismatch);
+  BOOST_CHECK_THROW(ser::deserialize<MyTypeIntrusive>(misrouted), ser::CannotDeserializeMessage);
+
+  // A map where a record's array should be
+  std::vector<unsigned char> map = { 'M', 0x81, 0x01, 0x02 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<MyTypeIntrusive>(map).error(), ser::kTypeMismatch);
+
+  // DUNE_DAQ_SERIALIZE_NON_INTRUSIVE types need exactly their number of fields
+  std::vector<unsigned char> short_array = { 'M', 0x91, 0x03 };
+  BOOST_CHECK_EQUAL(ser::try_deserialize<test::MyTypeNonIntrusive>(short_array).error(), ser::kTypeMismatch);
+  BOOST_CHECK_THROW(ser::deserialize<test::MyTypeNonIntrusive>(short_array), ser::CannotDeserializeMessage);
+  std::vector<unsigned char> full_array = { 'M', 0x92, 0x03, 0x90 };
+  BOOST_CHECK(ser::try_deserialize<test::MyTypeNonIntrusive>(full_array));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,203 @@
+/**
+ * @file StringInterning_test.cxx String interning Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/Serialization.hpp"
+#include "serialization/StringInterning.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE StringInterning_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <map>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+struct Record
+{
+  std::string source;
+  std::string kind;
+  int value;
+
+  DUNE_DAQ_SERIALIZE(Record, source, kind, value);
+};
+
+struct Bundle
+{
+  std::vector<Record> records;
+  std::map<std::string, int> counts;
+
+  DUNE_DAQ_SERIALIZE(Bundle, records, counts);
+};
+
+// A record holding a user EXT, which only has a MsgPack representation
+struct Tagged
+{
+  std::string source;
+  msgpack::type::ext tag;
+
+  MSGPACK_DEFINE(source, tag)
+};
+
+namespace ser = dunedaq::serialization;
+
+namespace {
+Bundle
+make_bundle(int n)
+{
+  Bundle b;
+  for (int i = 0; i < n; ++i) {
+    b.records.push_back(Record{ "detector_readout_" + std::to_string(i % 3), i % 2 ? "SuperFake" : "Fake", i });
+  }
+  b.counts["detector_readout_0"] = n;
+  b.counts["xy"] = 1;
+  return b;
+}
+
+void
+check_equal(const Bundle& a, const Bundle& b)
+{
+  BOOST_REQUIRE_EQUAL(a.records.size(), b.records.size());
+  for (size_t i = 0; i < a.records.size(); ++i) {
+    BOOST_CHECK_EQUAL(a.records[i].source, b.records[i].source);
+    BOOST_CHECK_EQUAL(a.records[i].kind, b.records[i].kind);
+    BOOST_CHECK_EQUAL(a.records[i].value, b.records[i].value);
+  }
+  BOOST_CHECK(a.counts == b.counts);
+}
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(StringInterning_test)
+
+BOOST_AUTO_TEST_CASE(EmbeddedDictionary)
+{
+  Bundle b = make_bundle(100);
+  std::vector<uint8_t> plain = ser::serialize(b, ser::kMsgPack);            // NOLINT(build/unsigned)
+  std::vector<uint8_t> interned = ser::serialize(b, ser::kMsgPackInterned); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(interned[0], 'I');
+  BOOST_CHECK_LT(interned.size(), plain.size() / 2);
+  check_equal(ser::deserialize<Bundle>(interned), b);
+  BOOST_CHECK(ser::from_string("msgpack_interned") == ser::kMsgPackInterned);
+}
+
+BOOST_AUTO_TEST_CASE(PersistentDictionary)
+{
+  ser::StringInternEncoder encoder;
+  ser::StringInternDecoder decoder;
+
+  Bundle b = make_bundle(3);
+  std::vector<uint8_t> first = encoder.encode(b);  // NOLINT(build/unsigned)
+  std::vector<uint8_t> second = encoder.encode(b); // NOLINT(build/unsigned)
+  // All of the strings in the second message were already sent in the first
+  BOOST_CHECK_LT(second.size(), first.size());
+  BOOST_CHECK_EQUAL(encoder.dictionary_size(), 5u);
+
+  check_equal(decoder.decode<Bundle>(first), b);
+  check_equal(decoder.decode<Bundle>(second), b);
+  BOOST_CHECK_EQUAL(decoder.dictionary_size(), encoder.dictionary_size());
+
+  // Different types can share the dictionary
+  Record r{ "detector_readout_1", "a new string", 7 };
+  Record r_recv = decoder.decode<Record>(encoder.encode(r));
+  BOOST_CHECK_EQUAL(r_recv.source, r.source);
+  BOOST_CHECK_EQUAL(r_recv.kind, r.kind);
+
+  // Frames in a std::pmr::vector decode the same way
+  std::vector<uint8_t> frame = encoder.encode(b);                  // NOLINT(build/unsigned)
+  std::pmr::vector<uint8_t> pmr_frame(frame.begin(), frame.end()); // NOLINT(build/unsigned)
+  check_equal(decoder.decode<Bundle>(pmr_frame), b);
+}
+
+BOOST_AUTO_TEST_CASE(DictionaryMismatch)
+{
+  ser::StringInternEncoder encoder;
+  Bundle b = make_bundle(3);
+  encoder.encode(b);
+  std::vector<uint8_t> second = encoder.encode(b); // NOLINT(build/unsigned)
+
+  // A decoder that missed the first frame can't decode the second
+  ser::StringInternDecoder decoder;
+  BOOST_CHECK_THROW(decoder.decode<Bundle>(second), ser::InternDictionaryMismatch);
+
+  encoder.reset();
+  check_equal(decoder.decode<Bundle>(encoder.encode(b)), b);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidReference)
+{
+  // A reference (fixext1 of the interning type) to string id 0, when
+  // no strings have been defined yet
+  std::vector<unsigned char> bad_ref = { 'I', 0xd4, 0x7e, 0x00 };
+  BOOST_CHECK_THROW(ser::deserialize<std::string>(bad_ref), ser::CannotDeserializeMessage);
+
+  ser::StringInternDecoder decoder;
+  std::vector<unsigned char> not_a_frame = { 'M', 0x01 };
+  BOOST_CHECK_THROW(decoder.decode<int>(not_a_frame), ser::UnknownSerializationTypeByte);
+}
+
+BOOST_AUTO_TEST_CASE(RejectsReservedExtType)
+{
+  ser::StringInternEncoder encoder;
+  ser::StringInternDecoder decoder;
+
+  // Other EXT types pass through untouched
+  Tagged ok{ "detector_readout_0", msgpack::type::ext(1, "xyz", 3) };
+  Tagged ok_recv = decoder.decode<Tagged>(encoder.encode(ok));
+  BOOST_CHECK_EQUAL(ok_recv.source, ok.source);
+  BOOST_CHECK(ok_recv.tag == ok.tag);
+  BOOST_CHECK_EQUAL(encoder.dictionary_size(), 1u);
+
+  // The interning type is rejected, after a new string was given an id
+  std::vector<Tagged> bad = { { "a new string", msgpack::type::ext(1, "xyz", 3) },
+                              { "detector_readout_0", msgpack::type::ext(0x7e, "\0", 1) } };
+  BOOST_CHECK_THROW(encoder.encode(bad), ser::ReservedExtType);
+  BOOST_CHECK_EQUAL(encoder.dictionary_size(), 1u);
+
+  // The encoder is still in sync with the decoder
+  Bundle b = make_bundle(3);
+  check_equal(decoder.decode<Bundle>(encoder.encode(b)), b);
+}
+
+BOOST_AUTO_TEST_CASE(InvalidFrameLeavesDictionaryUnchanged)
+{
+  // A frame against an empty dictionary: a new string "abc", then a
+  // reference to a string id that doesn't exist
+  std::vector<unsigned char> bad_frame = { 'S', 0x00, 0x92, 0xa3, 'a', 'b', 'c', 0xd4, 0x7e, 0x05 };
+  ser::StringInternDecoder decoder;
+  BOOST_CHECK_THROW(decoder.decode<std::vector<std::string>>(bad_frame), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(decoder.dictionary_size(), 0u);
+
+  // The decoder is still in sync with a fresh encoder
+  ser::StringInternEncoder encoder;
+  Bundle b = make_bundle(3);
+  check_equal(decoder.decode<Bundle>(encoder.encode(b)), b);
+}
+
+BOOST_AUTO_TEST_CASE(DeeplyNested)
+{
+  // A million nested single-element arrays around [ "abc", <reference
+  // to "abc"> ]. Resolving it mustn't recurse once per level
+  std::vector<unsigned char> nested(1 << 20, 0x91);
+  nested.insert(nested.end(), { 0x92, 0xa3, 'a', 'b', 'c', 0xd4, 0x7e, 0x00 });
+
+  std::vector<unsigned char> message = { 'I' };
+  message.insert(message.end(), nested.begin(), nested.end());
+  BOOST_CHECK_THROW(ser::deserialize<int>(message), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(ser::try_deserialize<int>(message).error(), ser::kTypeMismatch);
+
+  std::vector<unsigned char> frame = { 'S', 0x00 };
+  frame.insert(frame.end(), nested.begin(), nested.end());
+  ser::StringInternDecoder decoder;
+  BOOST_CHECK_THROW(decoder.decode<int>(frame), ser::CannotDeserializeMessage);
+  BOOST_CHECK_EQUAL(decoder.dictionary_size(), 1u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
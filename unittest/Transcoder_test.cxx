@@ -0,0 +1,349 @@
+/**
+ * @file Transcoder_test.cxx MsgPack/JSON transcoder Unit Tests
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "serialization/Serialization.hpp"
+#include "serialization/Transcoder.hpp"
+
+/**
+ * @brief Name of this test module
+ */
+#define BOOST_TEST_MODULE Transcoder_test // NOLINT
+
+#include "boost/test/data/test_case.hpp"
+#include "boost/test/unit_test.hpp"
+
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct Hit
+{
+  int channel;
+  double adc;
+  std::string source;
+
+  DUNE_DAQ_SERIALIZE(Hit, channel, adc, source);
+};
+
+namespace ns {
+struct Trigger
+{
+  int64_t timestamp;
+  std::vector<Hit> hits;
+  Hit max_hit;
+  std::vector<uint8_t> payload; // NOLINT(build/unsigned)
+  std::map<std::string, int> counts;
+};
+} // namespace ns
+
+DUNE_DAQ_SERIALIZE_NON_INTRUSIVE(ns, Trigger, timestamp, hits, max_hit, payload, counts);
+
+// nlohmann::json has no std::optional support of its own
+namespace nlohmann {
+template<typename T>
+struct adl_serializer<std::optional<T>>
+{
+  static void to_json(json& j, const std::optional<T>& v) { j = v ? json(*v) : json(nullptr); }
+  static void from_json(const json& j, std::optional<T>& v)
+  {
+    if (j.is_null())
+      v.reset();
+    else
+      v = j.get<T>();
+  }
+};
+} // namespace nlohmann
+
+struct Detector
+{
+  std::map<int, Hit> by_channel; // JSON writes these as [[key, value], ...]
+  std::map<std::string, Hit> by_name;
+  std::map<int, int> thresholds;
+  std::optional<Hit> loudest;
+
+  DUNE_DAQ_SERIALIZE(Detector, by_channel, by_name, thresholds, loudest);
+};
+
+namespace ser = dunedaq::serialization;
+using json = nlohmann::json;
+
+ns::Trigger
+make_trigger()
+{
+  ns::Trigger t;
+  t.timestamp = -123456789012;
+  t.hits = { { 1, 10.5, "crate1" }, { 2, 3.0, "crate \"2\"\n" } };
+  t.max_hit = t.hits[0];
+  t.payload = { 0, 1, 254, 255 };
+  t.counts = { { "a", 1 }, { "b", 2 } };
+  return t;
+}
+
+json
+parse_payload(const std::vector<uint8_t>& message) // NOLINT(build/unsigned)
+{
+  BOOST_REQUIRE_EQUAL(message.at(0), ser::serialization_type_byte(ser::kJSON));
+  return json::parse(message.begin() + 1, message.end());
+}
+
+void
+check_equal(const ns::Trigger& a, const ns::Trigger& b)
+{
+  BOOST_CHECK_EQUAL(a.timestamp, b.timestamp);
+  BOOST_REQUIRE_EQUAL(a.hits.size(), b.hits.size());
+  for (std::size_t i = 0; i < a.hits.size(); ++i) {
+    BOOST_CHECK_EQUAL(a.hits[i].channel, b.hits[i].channel);
+    BOOST_CHECK_EQUAL(a.hits[i].adc, b.hits[i].adc);
+    BOOST_CHECK_EQUAL(a.hits[i].source, b.hits[i].source);
+  }
+  BOOST_CHECK_EQUAL(a.max_hit.source, b.max_hit.source);
+  BOOST_CHECK(a.payload == b.payload);
+  BOOST_CHECK(a.counts == b.counts);
+}
+
+BOOST_AUTO_TEST_SUITE(Transcoder_test)
+
+BOOST_AUTO_TEST_CASE(Registry)
+{
+  ser::FieldRegistry registry;
+  registry.add<ns::Trigger>();
+  // Trigger and Hit
+  BOOST_CHECK_EQUAL(registry.size(), 2u);
+
+  auto fields = registry.find("Trigger");
+  BOOST_REQUIRE(fields);
+  BOOST_REQUIRE_EQUAL(fields->size(), 5u);
+  BOOST_CHECK_EQUAL((*fields)[0].name, "timestamp");
+  BOOST_CHECK_EQUAL((*fields)[0].kind, ser::kValue);
+  BOOST_CHECK_EQUAL((*fields)[1].kind, ser::kRecordSequence);
+  BOOST_CHECK_EQUAL((*fields)[2].kind, ser::kRecord);
+  BOOST_CHECK_EQUAL((*fields)[1].record, (*fields)[2].record);
+  BOOST_CHECK_EQUAL((*fields)[3].kind, ser::kBinary);
+
+  auto hit_fields = registry.find((*fields)[1].record);
+  BOOST_REQUIRE(hit_fields);
+  BOOST_CHECK_EQUAL(hit_fields->at(2).name, "source");
+
+  BOOST_CHECK(registry.find("NoSuchType") == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(MsgPackToJson)
+{
+  ser::FieldRegistry registry;
+  registry.add<ns::Trigger>();
+  ns::Trigger t = make_trigger();
+
+  std::vector<uint8_t> msgpack_bytes = ser::serialize(t, ser::kMsgPack); // NOLINT(build/unsigned)
+  std::vector<uint8_t> json_bytes = ser::msgpack_to_json(msgpack_bytes, &registry, "Trigger"); // NOLINT(build/unsigned)
+
+  // Same document as serialize(kJSON), up to the order of object keys
+  BOOST_CHECK_EQUAL(parse_payload(json_bytes), parse_payload(ser::serialize(t, ser::kJSON)));
+  check_equal(ser::deserialize<ns::Trigger>(json_bytes), t);
+
+  // Interned messages too
+  std::vector<uint8_t> interned_bytes = ser::serialize(t, ser::kMsgPackInterned); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(parse_payload(ser::msgpack_to_json(interned_bytes, &registry, "Trigger")),
+                    parse_payload(json_bytes));
+
+  // Without field names, records are arrays
+  json anonymous = parse_payload(ser::msgpack_to_json(msgpack_bytes));
+  BOOST_REQUIRE(anonymous.is_array());
+  BOOST_CHECK_EQUAL(anonymous[0], t.timestamp);
+  BOOST_CHECK_EQUAL(anonymous[2][2], "crate1");
+  BOOST_CHECK_EQUAL(anonymous[4]["b"], 2);
+}
+
+BOOST_AUTO_TEST_CASE(JsonToMsgPack)
+{
+  ser::FieldRegistry registry;
+  registry.add<ns::Trigger>();
+  ns::Trigger t = make_trigger();
+
+  // nlohmann::json writes object keys in alphabetical order, so the
+  // fields have to be put back in declaration order
+  std::vector<uint8_t> json_bytes = ser::serialize(t, ser::kJSON);                             // NOLINT(build/unsigned)
+  std::vector<uint8_t> msgpack_bytes = ser::json_to_msgpack(json_bytes, &registry, "Trigger"); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(msgpack_bytes[0], ser::serialization_type_byte(ser::kMsgPack));
+  check_equal(ser::deserialize<ns::Trigger>(msgpack_bytes), t);
+
+  // And back again
+  BOOST_CHECK_EQUAL(parse_payload(ser::msgpack_to_json(msgpack_bytes, &registry, "Trigger")),
+                    parse_payload(json_bytes));
+
+  // Unknown fields are ignored; missing ones are an error
+  std::string extra = R"(J{"timestamp":1,"hits":[],"max_hit":{"channel":1,"adc":0.5,"source":"s","x":[1]},)"
+                      R"("payload":[],"counts":{},"unknown":{"a":[1,2]}})";
+  std::vector<uint8_t> extra_bytes = // NOLINT(build/unsigned)
+    ser::json_to_msgpack(std::vector<char>(extra.begin(), extra.end()), &registry, "Trigger");
+  ns::Trigger t_extra = ser::deserialize<ns::Trigger>(extra_bytes);
+  BOOST_CHECK_EQUAL(t_extra.max_hit.source, "s");
+
+  std::string missing = R"(J{"timestamp":1,"hits":[]})";
+  BOOST_CHECK_THROW(ser::json_to_msgpack(std::vector<char>(missing.begin(), missing.end()), &registry, "Trigger"),
+                    ser::CannotTranscodeMessage);
+}
+
+BOOST_AUTO_TEST_CASE(Maps)
+{
+  ser::FieldRegistry registry;
+  registry.add<Detector>();
+  const std::string typestring = ser::FieldRegistry::key<Detector>();
+  auto fields = registry.find(typestring);
+  BOOST_REQUIRE(fields);
+  BOOST_CHECK_EQUAL((*fields)[0].kind, ser::kMap);
+  BOOST_CHECK(!(*fields)[0].string_keys);
+  BOOST_CHECK_EQUAL((*fields)[0].record, ser::FieldRegistry::key<Hit>());
+  BOOST_CHECK_EQUAL((*fields)[1].kind, ser::kMap);
+  BOOST_CHECK((*fields)[1].string_keys);
+  BOOST_CHECK_EQUAL((*fields)[2].kind, ser::kMap);
+  BOOST_CHECK((*fields)[2].record.empty());
+  BOOST_CHECK_EQUAL((*fields)[3].kind, ser::kRecord);
+
+  Detector full;
+  full.by_channel = { { 3, { 3, 1.5, "a" } }, { -1, { -1, 2.5, "b" } } };
+  full.by_name = { { "c", { 7, 0.5, "c" } } };
+  full.thresholds = { { 1, 10 }, { 2, 20 } };
+  full.loudest = Hit{ 3, 1.5, "a" };
+  // Empty maps, including one whose keys aren't strings, and an empty optional
+  Detector empty;
+
+  for (const Detector& d : { full, empty }) {
+    json expected = parse_payload(ser::serialize(d, ser::kJSON));
+
+    std::vector<uint8_t> json_bytes = // NOLINT(build/unsigned)
+      ser::msgpack_to_json(ser::serialize(d, ser::kMsgPack), &registry, typestring);
+    BOOST_CHECK_EQUAL(parse_payload(json_bytes), expected);
+    BOOST_CHECK_EQUAL(parse_payload(ser::serialize(ser::deserialize<Detector>(json_bytes), ser::kJSON)), expected);
+
+    std::vector<uint8_t> msgpack_bytes = // NOLINT(build/unsigned)
+      ser::json_to_msgpack(ser::serialize(d, ser::kJSON), &registry, typestring);
+    BOOST_CHECK_EQUAL(parse_payload(ser::serialize(ser::deserialize<Detector>(msgpack_bytes), ser::kJSON)), expected);
+  }
+
+  // A map entry must be a [key, value] pair
+  std::string bad = R"(J{"by_channel":[[1]],"by_name":{},"thresholds":[],"loudest":null})";
+  BOOST_CHECK_THROW(ser::json_to_msgpack(std::vector<char>(bad.begin(), bad.end()), &registry, typestring),
+                    ser::CannotTranscodeMessage);
+}
+
+BOOST_AUTO_TEST_CASE(ChecksummedMessage)
+{
+  ser::FieldRegistry registry;
+  registry.add<ns::Trigger>();
+  ns::Trigger t = make_trigger();
+
+  ser::SerializationOptions options;
+  options.checksum = ser::kCRC32C;
+  std::vector<uint8_t> bytes = ser::serialize(t, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  BOOST_REQUIRE_EQUAL(bytes[0], ser::checksum_type_byte);
+
+  // The checksum is stripped, leaving a plain JSON message
+  std::vector<uint8_t> json_bytes = ser::msgpack_to_json(bytes, &registry, "Trigger"); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(parse_payload(json_bytes), parse_payload(ser::serialize(t, ser::kJSON)));
+  check_equal(ser::deserialize<ns::Trigger>(json_bytes), t);
+
+  // The last byte is the value of the last entry in counts
+  bytes.back() ^= 1;
+  BOOST_CHECK_THROW(ser::msgpack_to_json(bytes, &registry, "Trigger"), ser::ChecksumMismatch);
+  ser::DeserializationOptions unverified;
+  unverified.verify_checksum = false;
+  BOOST_CHECK_EQUAL(parse_payload(ser::msgpack_to_json(bytes, &registry, "Trigger", unverified))["counts"]["b"], 3);
+
+  // A checksummed JSON message is still not a MsgPack one
+  BOOST_CHECK_THROW(ser::msgpack_to_json(ser::serialize(t, ser::kJSON, options)), ser::CannotTranscodeMessage);
+}
+
+BOOST_DATA_TEST_CASE(CompressedMessage, boost::unit_test::data::make({ ser::kLZ4, ser::kZstd }), mode)
+{
+  ser::FieldRegistry registry;
+  registry.add<ns::Trigger>();
+  ns::Trigger t = make_trigger();
+  t.payload.assign(10000, 7);
+
+  ser::SerializationOptions options;
+  options.compression = mode;
+  options.checksum = ser::kCRC32C;
+  bool available = mode == ser::kLZ4 ? ser::detail::Lz4Codec::available : ser::detail::ZstdCodec::available;
+  if (!available) {
+    BOOST_TEST_MESSAGE("Codec not available in this build, skipping");
+    return;
+  }
+
+  std::vector<uint8_t> bytes = ser::serialize(t, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  BOOST_REQUIRE_EQUAL(bytes[ser::checksum_header_size], mode == ser::kLZ4 ? ser::lz4_type_byte : ser::zstd_type_byte);
+  std::vector<uint8_t> json_bytes = ser::msgpack_to_json(bytes, &registry, "Trigger"); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(parse_payload(json_bytes), parse_payload(ser::serialize(t, ser::kJSON)));
+
+  ser::DeserializationOptions limited;
+  limited.max_decompressed_size = 1000;
+  BOOST_CHECK_THROW(ser::msgpack_to_json(bytes, &registry, "Trigger", limited), ser::CannotTranscodeMessage);
+}
+
+BOOST_DATA_TEST_CASE(EnvelopeRoundTrip,
+                     boost::unit_test::data::make({ ser::kNoCompression, ser::kLZ4, ser::kZstd }),
+                     mode)
+{
+  ser::FieldRegistry registry;
+  registry.add<ns::Trigger>();
+  ns::Trigger t = make_trigger();
+  t.payload.assign(10000, 7);
+
+  ser::SerializationOptions options;
+  options.compression = mode;
+  options.checksum = ser::kCRC32C;
+  bool available = mode == ser::kLZ4    ? ser::detail::Lz4Codec::available
+                   : mode == ser::kZstd ? ser::detail::ZstdCodec::available
+                                        : true;
+  if (!available) {
+    BOOST_TEST_MESSAGE("Codec not available in this build, skipping");
+    return;
+  }
+
+  // Both directions unwrap the input and wrap the output as asked
+  std::vector<uint8_t> bytes = ser::serialize(t, ser::kMsgPack, options); // NOLINT(build/unsigned)
+  std::vector<uint8_t> json_bytes =                                       // NOLINT(build/unsigned)
+    ser::msgpack_to_json(bytes, &registry, "Trigger", ser::DeserializationOptions(), options);
+  BOOST_REQUIRE_EQUAL(json_bytes[0], ser::checksum_type_byte);
+  if (mode != ser::kNoCompression) {
+    uint8_t type_byte = mode == ser::kLZ4 ? ser::lz4_type_byte : ser::zstd_type_byte; // NOLINT(build/unsigned)
+    BOOST_CHECK_EQUAL(json_bytes[ser::checksum_header_size], type_byte);
+  }
+  check_equal(ser::deserialize<ns::Trigger>(json_bytes), t);
+
+  std::vector<uint8_t> msgpack_bytes = // NOLINT(build/unsigned)
+    ser::json_to_msgpack(json_bytes, &registry, "Trigger", ser::DeserializationOptions(), options);
+  BOOST_REQUIRE_EQUAL(msgpack_bytes[0], ser::checksum_type_byte);
+  check_equal(ser::deserialize<ns::Trigger>(msgpack_bytes), t);
+
+  // By default the output is a plain message
+  std::vector<uint8_t> plain = ser::json_to_msgpack(json_bytes, &registry, "Trigger"); // NOLINT(build/unsigned)
+  BOOST_CHECK_EQUAL(plain[0], ser::serialization_type_byte(ser::kMsgPack));
+  check_equal(ser::deserialize<ns::Trigger>(plain), t);
+
+  json_bytes.back() ^= 1;
+  BOOST_CHECK_THROW(ser::json_to_msgpack(json_bytes, &registry, "Trigger"), ser::ChecksumMismatch);
+}
+
+BOOST_AUTO_TEST_CASE(Errors)
+{
+  std::vector<uint8_t> json_bytes = ser::serialize(make_trigger(), ser::kJSON);       // NOLINT(build/unsigned)
+  std::vector<uint8_t> msgpack_bytes = ser::serialize(make_trigger(), ser::kMsgPack); // NOLINT(build/unsigned)
+
+  BOOST_CHECK_THROW(ser::msgpack_to_json(json_bytes), ser::CannotTranscodeMessage);
+  BOOST_CHECK_THROW(ser::json_to_msgpack(msgpack_bytes), ser::CannotTranscodeMessage);
+  BOOST_CHECK_THROW(ser::msgpack_to_json(std::vector<uint8_t>()), ser::CannotTranscodeMessage); // NOLINT
+  BOOST_CHECK_THROW(ser::json_to_msgpack(std::vector<uint8_t>()), ser::CannotTranscodeMessage); // NOLINT
+
+  std::vector<uint8_t> truncated(msgpack_bytes.begin(), msgpack_bytes.end() - 3); // NOLINT(build/unsigned)
+  BOOST_CHECK_THROW(ser::msgpack_to_json(truncated), ser::CannotTranscodeMessage);
+  truncated.assign(json_bytes.begin(), json_bytes.end() - 3);
+  BOOST_CHECK_THROW(ser::json_to_msgpack(truncated), ser::CannotTranscodeMessage);
+}
+
+BOOST_AUTO_TEST_SUITE_END()